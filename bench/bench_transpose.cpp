@@ -0,0 +1,48 @@
+#include <chrono>
+#include <iostream>
+#include <opencv2/opencv.hpp>
+#include "scrambler_kernels.h"
+#include "util.h"
+
+// transpose_into vs cv::transpose on full frames, both writing into a preallocated buffer
+
+template <typename Fn>
+double time_ms(Fn fn, int num_iterations) {
+    fn();  // warm up caches and buffers
+    auto start = std::chrono::steady_clock::now();
+    for(auto i = 0; i < num_iterations; ++i) {
+        fn();
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / num_iterations;
+}
+
+int main(int argc, char **argv) {
+    const int num_iterations = argc > 1 ? std::stoi(argv[1]) : 50;
+    const std::vector<std::pair<std::string, cv::Size>> sizes{
+        {"720p", {1280, 720}}, {"1080p", {1920, 1080}}, {"4K", {3840, 2160}}};
+    auto &pool = get_default_thread_pool();
+
+    std::cout << format("{} threads, {} iterations\n", pool.get_num_threads(), num_iterations);
+    std::cout << format("{:>6} {:>6} {:>17} {:>17} {:>8}\n", "size", "type", "cv::transpose ms", "transpose_into ms", "speedup");
+
+    for(const auto &size : sizes) {
+        for(auto type : {CV_8UC1, CV_8UC3}) {
+            cv::Mat src(size.second, type);
+            cv::randu(src, cv::Scalar::all(0), cv::Scalar::all(256));
+            cv::Mat expected(size.second.width, size.second.height, type);
+            cv::Mat actual(size.second.width, size.second.height, type);
+
+            auto reference_ms = time_ms([&]() { cv::transpose(src, expected); }, num_iterations);
+            auto kernel_ms = time_ms([&]() { transpose_into(src, actual, pool); }, num_iterations);
+
+            if (cv::norm(expected, actual, cv::NORM_INF) != 0) {
+                std::cerr << format("transpose_into mismatch at {} type {}\n", size.first, type);
+                return 1;
+            }
+            std::cout << format("{:>6} {:>6} {:>17.3f} {:>17.3f} {:>7.2f}x\n", size.first,
+                                type == CV_8UC1 ? "8UC1" : "8UC3", reference_ms, kernel_ms, reference_ms / kernel_ms);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,367 @@
+#include "pipeline_parser.h"
+#include "reed_solomon.h"
+#include <argparse/argparse.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+
+// Microbenchmarks of every scrambler (forward and inverse), the data embed codec, the Reed-Solomon blocks and the
+// data region detection on synthetic 720p / 1080p / 4K frames. Each case runs for at least --min-time ms and is
+// reported as json (time, bytes, throughput and allocations per frame, one call being one frame), so the numbers
+// of two releases can be diffed.
+
+// heap allocations through operator new of this binary (a library with its own runtime, as a Windows dll, is not
+// seen), and the frame buffers OpenCV allocates
+static std::atomic<size_t> num_heap_allocations{0};
+
+// the replacements pair malloc with free, which gcc cannot see through
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void *operator new(size_t size) {
+    ++num_heap_allocations;
+    if (void *ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+class CountingAllocator : public cv::MatAllocator {
+public:
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step,
+                           cv::AccessFlag flags, cv::UMatUsageFlags usage_flags) const override {
+        if (data == nullptr) {
+            ++num_allocations;
+        }
+        return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage_flags);
+    }
+
+    bool allocate(cv::UMatData *data, cv::AccessFlag flags, cv::UMatUsageFlags usage_flags) const override {
+        return cv::Mat::getStdAllocator()->allocate(data, flags, usage_flags);
+    }
+
+    void deallocate(cv::UMatData *data) const override {
+        cv::Mat::getStdAllocator()->deallocate(data);
+    }
+
+    mutable std::atomic<size_t> num_allocations{0};
+};
+
+static CountingAllocator frame_allocator;
+
+// a pipeline of every scrambler, as the frames of the detection case are made with
+const char *bench_pipeline_spec = R"({
+    "data_embed_block_size": 8,
+    "data_embed_num_rows": 4,
+    "steps": [
+        {"name": "ImageShift", "sx": 3, "sy": -2},
+        {"name": "RowShuffle", "row_group_size": 8, "random_seed": 42},
+        {"name": "ImageTranspose"},
+        {"name": "RowMix", "row_group_size": 4, "random_seed": 7},
+        {"name": "ImageTranspose"},
+        {"name": "RowShuffle", "row_group_size": 8, "random_seed": 300}
+    ]
+})";
+
+struct BenchOptions {
+    int min_time_ms = 200;
+    int min_iterations = 3;
+    std::string filter;
+};
+
+class BenchRunner {
+public:
+    explicit BenchRunner(const BenchOptions &options) : _options(options) {}
+
+    // bytes is the amount of data a call reads and writes, for the throughput; size is the frame size or empty
+    template<typename Fn>
+    void run(const std::string &name, const std::string &size_name, const cv::Size &size, size_t bytes, Fn &&fn) {
+        const auto full_name = size_name.empty() ? name : format("{}/{}", name, size_name);
+        if (!_options.filter.empty() && full_name.find(_options.filter) == std::string::npos) {
+            return;
+        }
+
+        // warms up caches and lets the scratch buffers reach their steady state
+        fn();
+
+        const size_t heap_begin = num_heap_allocations, frame_begin = frame_allocator.num_allocations;
+        const auto start = std::chrono::steady_clock::now();
+        std::chrono::duration<double, std::milli> elapsed{0};
+        int num_iterations = 0;
+        while(num_iterations < _options.min_iterations || elapsed.count() < _options.min_time_ms) {
+            fn();
+            ++num_iterations;
+            elapsed = std::chrono::steady_clock::now() - start;
+        }
+        const size_t num_heap = num_heap_allocations - heap_begin;
+        const size_t num_frame = frame_allocator.num_allocations - frame_begin;
+
+        const double ns_per_frame = elapsed.count() * 1e6 / num_iterations;
+        nlohmann::ordered_json result;
+        result["name"] = name;
+        result["size"] = size_name.empty() ? nlohmann::ordered_json() : nlohmann::ordered_json(size_name);
+        result["width"] = size.width;
+        result["height"] = size.height;
+        result["iterations"] = num_iterations;
+        result["ns_per_frame"] = ns_per_frame;
+        result["bytes_per_frame"] = bytes;
+        result["gb_per_s"] = ns_per_frame > 0.0 ? bytes / ns_per_frame : 0.0;
+        result["allocations_per_frame"] = (double)num_heap / num_iterations;
+        result["frame_allocations_per_frame"] = (double)num_frame / num_iterations;
+        _results.push_back(result);
+
+        std::cerr << format("{:<48} {:>14.0f} ns {:>8.2f} GB/s {:>8.1f} allocs\n", full_name, ns_per_frame,
+                            result["gb_per_s"].get<double>(), (double)(num_heap + num_frame) / num_iterations);
+    }
+
+    const std::vector<nlohmann::ordered_json> &results() const {
+        return _results;
+    }
+
+private:
+    BenchOptions _options;
+    std::vector<nlohmann::ordered_json> _results;
+};
+
+static cv::Mat random_frame(const cv::Size &size) {
+    cv::Mat ret(size, CV_8UC3);
+    cv::randu(ret, cv::Scalar::all(0), cv::Scalar::all(256));
+    return ret;
+}
+
+static size_t frame_bytes(const cv::Mat &img) {
+    return img.total() * img.elemSize();
+}
+
+// forward and inverse of each scrambler through the lazy views of the pipeline, into reused buffers; a view that is
+// left over is materialized, so the view only steps report the cost of the copy that reads them
+static void bench_scramblers(BenchRunner &runner, const std::string &size_name, const cv::Mat &img,
+                             ThreadPool &pool) {
+    const std::vector<std::pair<std::string, std::shared_ptr<ScramblerBase>>> steps{
+        {"ImageTranspose", std::make_shared<ImageTranspose>()},
+        {"RowShuffle", std::make_shared<RowShuffle>(8, 42)},
+        {"RowMix", std::make_shared<RowMix>(4, 7)},
+        {"ImageShift", std::make_shared<ImageShift>(3, -2)},
+    };
+    for(const auto &step : steps) {
+        ScramblerState state;
+        step.second->fit(state, img);
+        state.timestamp = 5;
+
+        cv::Mat buffer, out;
+        auto run_view = [&](bool inverse, const cv::Mat &input) -> const cv::Mat & {
+            auto view = inverse ? step.second->inverse_transform_view(state, FrameView(input), buffer, pool)
+                                : step.second->transform_view(state, FrameView(input), buffer, pool);
+            if (view.is_plain() && view.base().data == buffer.data) {
+                return buffer;
+            }
+            view.materialize(out, pool);
+            return out;
+        };
+        const cv::Mat scrambled = run_view(false, img).clone();
+
+        runner.run(format("{}::transform", step.first), size_name, img.size(), 2 * frame_bytes(img),
+                   [&]() { run_view(false, img); });
+        runner.run(format("{}::inverse_transform", step.first), size_name, img.size(), 2 * frame_bytes(img),
+                   [&]() { run_view(true, scrambled); });
+    }
+}
+
+// the gather of a fused run with the wrap offsets of its shifts folded in, against the same map without offsets,
+// which is all a map rebuilt for every phase of the shifts could save
+static void bench_gather(BenchRunner &runner, const std::string &size_name, const cv::Mat &img, ThreadPool &pool) {
+    const std::vector<std::shared_ptr<ScramblerBase>> steps{std::make_shared<RowShuffle>(8, 42),
+                                                            std::make_shared<ImageTranspose>()};
+    ScramblerState state;
+    cv::Mat step_img = img;
+    for(const auto &step : steps) {
+        step->fit(state, step_img);
+        step_img = step->transform(state, step_img);
+    }
+    const auto map = GatherMap::compile(state, steps, img.size(), false);
+    const auto src_offset = normalize_wrap_offset(15, -10, img.cols, img.rows);
+    const auto dst_offset = normalize_wrap_offset(-25, 5, map.output_size().width, map.output_size().height);
+
+    cv::Mat out;
+    runner.run("GatherMap::apply", size_name, img.size(), 2 * frame_bytes(img),
+               [&]() { map.apply(img, out, cv::Point(0, 0), cv::Point(0, 0), pool); });
+    runner.run("GatherMap::apply(offsets)", size_name, img.size(), 2 * frame_bytes(img),
+               [&]() { map.apply(img, out, src_offset, dst_offset, pool); });
+}
+
+static void bench_data_embed(BenchRunner &runner, const std::string &size_name, const cv::Mat &img,
+                             const std::string &payload, ThreadPool &pool) {
+    DataEmbed embed(8, 4, img.cols);
+    cv::Mat out;
+    runner.run("DataEmbed::encoded_data_as_image", size_name, img.size(), 2 * frame_bytes(img),
+               [&]() { embed.encoded_data_as_image(FrameView(img), payload, out, pool); });
+
+    const auto band = embed.render_data_band(payload);
+    runner.run("DataEmbed::encoded_data_as_image(band)", size_name, img.size(), 2 * frame_bytes(img),
+               [&]() { embed.encoded_data_as_image(FrameView(img), band, 5, out, pool); });
+}
+
+static void bench_detection(BenchRunner &runner, const std::string &size_name, const cv::Mat &img) {
+    auto pipeline = build_pipeline_from_json(bench_pipeline_spec);
+    pipeline->fit(img);
+    const auto scrambled = pipeline->transform(img, 0);
+
+    ImageDataTransform info;
+    if (!VideoScramblePipeline::get_data_extraction_transform(scrambled, info)) {
+        std::cerr << format("no data region found in the {} frame\n", size_name);
+        return;
+    }
+    runner.run("get_data_extraction_transform", size_name, scrambled.size(), frame_bytes(scrambled),
+               [&]() { VideoScramblePipeline::get_data_extraction_transform(scrambled, info); });
+}
+
+// the codecs do not depend on the frame size
+static void bench_codecs(BenchRunner &runner, const std::string &payload) {
+    DataEmbed embed(8, 4, 1920);
+    const auto enc_data = embed.encode_data(payload);
+    runner.run("DataEmbed::encode_data", "", {}, payload.size() + enc_data.size(),
+               [&]() { embed.encode_data(payload); });
+    runner.run("DataEmbed::decode_data", "", {}, payload.size() + enc_data.size(),
+               [&]() { DataEmbed::decode_data(enc_data); });
+
+    const auto expanded = expand_representation(enc_data, data_embed_expansion);
+    runner.run("expand_representation", "", {}, enc_data.size() + expanded.size(),
+               [&]() { expand_representation(enc_data, data_embed_expansion); });
+    runner.run("shrink_representation", "", {}, enc_data.size() + expanded.size(),
+               [&]() { shrink_representation(expanded, data_embed_expansion); });
+
+    // a band worth of blocks
+    const size_t num_blocks = 1024;
+    std::vector<char> data(num_blocks * rs_data_length);
+    for(size_t i = 0; i < data.size(); ++i) {
+        data[i] = (char)((i * 7 + 3) & 0x0F);
+    }
+    std::vector<int8_t> code(rs_encoded_size(data.size())), decoded(data.size());
+    rs_encode_blocks(data.data(), data.size(), code.data());
+    // one correctable error per block
+    for(size_t b = 0; b < num_blocks; ++b) {
+        code[b * rs_code_length + b % rs_code_length] ^= 0x05;
+    }
+    runner.run("rs_encode_blocks", "", {}, data.size() + code.size(),
+               [&]() { rs_encode_blocks(data.data(), data.size(), code.data()); });
+    runner.run("rs_decode_blocks", "", {}, data.size() + code.size(),
+               [&]() { rs_decode_blocks(code.data(), num_blocks, decoded.data()); });
+}
+
+
+int main(int argc, char *argv[]) {
+    argparse::ArgumentParser program("vidscramble_bench");
+
+    program.add_argument("-o", "--output")
+            .help("write the json report to this file instead of stdout")
+            .default_value(std::string(""));
+    program.add_argument("--min-time")
+            .help("minimum time in ms each case runs for")
+            .default_value(200)
+            .scan<'i', int>();
+    program.add_argument("--min-iterations")
+            .help("minimum number of calls of each case")
+            .default_value(3)
+            .scan<'i', int>();
+    program.add_argument("--filter")
+            .help("only run the cases whose name (with the frame size, as in RowMix::transform/1080p) contains this")
+            .default_value(std::string(""));
+    program.add_argument("--sizes")
+            .help("comma separated frame sizes to run, any of 720p, 1080p and 4K")
+            .default_value(std::string("720p,1080p,4K"));
+
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::exception& err) {
+        std::cerr << format("invalid arguments: {}", err.what());
+        return 1;
+    }
+
+    BenchOptions options;
+    options.min_time_ms = program.get<int>("--min-time");
+    options.min_iterations = std::max(1, program.get<int>("--min-iterations"));
+    options.filter = program.get<std::string>("--filter");
+    const auto output_filename = program.get<std::string>("--output");
+
+    const std::vector<std::pair<std::string, cv::Size>> known_sizes{
+        {"720p", {1280, 720}}, {"1080p", {1920, 1080}}, {"4K", {3840, 2160}}};
+    std::vector<std::pair<std::string, cv::Size>> sizes;
+    std::istringstream size_names(program.get<std::string>("--sizes"));
+    for(std::string name; std::getline(size_names, name, ',');) {
+        auto iter = std::find_if(known_sizes.begin(), known_sizes.end(), [&](const auto &s) { return s.first == name; });
+        if (iter == known_sizes.end()) {
+            std::cerr << format("unknown frame size \"{}\"\n", name);
+            return 1;
+        }
+        sizes.push_back(*iter);
+    }
+
+    cv::Mat::setDefaultAllocator(&frame_allocator);
+    auto &pool = get_default_thread_pool();
+    BenchRunner runner(options);
+    try {
+        // the payload a pipeline embeds into every data frame
+        auto payload_pipeline = build_pipeline_from_json(bench_pipeline_spec);
+        payload_pipeline->fit(cv::Mat(1080, 1920, CV_8UC3, cv::Scalar::all(0)));
+        const auto payload = payload_pipeline->to_json();
+        bench_codecs(runner, payload);
+        for(const auto &size : sizes) {
+            const auto img = random_frame(size.second);
+            bench_scramblers(runner, size.first, img, pool);
+            bench_gather(runner, size.first, img, pool);
+            bench_data_embed(runner, size.first, img, payload, pool);
+            bench_detection(runner, size.first, img);
+        }
+    } catch (const std::exception &e) {
+        std::cerr << format("benchmark failed: {}\n", e.what());
+        return 1;
+    }
+    cv::Mat::setDefaultAllocator(nullptr);
+
+    nlohmann::ordered_json report;
+    report["threads"] = pool.get_num_threads();
+    report["min_time_ms"] = options.min_time_ms;
+    report["results"] = runner.results();
+    if (output_filename.empty()) {
+        std::cout << report.dump(2) << "\n";
+    } else {
+        std::ofstream out(output_filename);
+        out << report.dump(2) << "\n";
+        if (!out) {
+            std::cerr << format("unable to write \"{}\"\n", output_filename);
+            return 1;
+        }
+    }
+    return 0;
+}
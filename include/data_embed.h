@@ -1,8 +1,9 @@
 #pragma once
 
 #include "scrambler.h"
-#include <zstr.hpp>
+#include "reed_solomon.h"
 #include <array>
+#include <optional>
 #include <opencv2/objdetect/aruco_dictionary.hpp>
 #include <opencv2/objdetect/aruco_detector.hpp>
 
@@ -15,17 +16,46 @@
 
 
 
-/* Reed Solomon Code Parameters */
-constexpr const size_t rs_code_length = 15;
-constexpr const size_t rs_fec_length  = 3;
-constexpr const size_t rs_data_length = rs_code_length - rs_fec_length;
+constexpr const int data_embed_expansion = 4;
 
-/* Finite Field Parameters */
-constexpr const size_t field_descriptor                =   4;
-constexpr const size_t generator_polynomial_index      = 0;
-constexpr const size_t generator_polynomial_root_count =  rs_fec_length;
+// white rows above the image; the top pad needs to be aligned with block size to avoid significant quality loss
+constexpr const int data_embed_top_pad_rows = 16;
+
+// Payload layout: a metadata header (3 x uint16: rows, blocks per row, compressed size), optionally followed by a
+// timestamp field, then the compressed json. The timestamp field (a tag byte that cannot start a gzip stream and a 40 bit
+// big endian timestamp) fills the rest of the first RS block, so a new timestamp only re-encodes that block.
+constexpr const int data_embed_metadata_size = 6;
+constexpr const uint8_t data_embed_timestamp_tag = 0x01;
+constexpr const int data_embed_timestamp_bytes = 5;
+constexpr const int data_embed_timestamp_field_size = 1 + data_embed_timestamp_bytes;
+static_assert(data_embed_metadata_size + data_embed_timestamp_field_size == rs_data_length,
+              "the header and the timestamp field must fill exactly one RS block");
+
+// How the data in the payload is compressed. Decoding handles every mode: a gzip stream starts with 0x1f, the others
+// with their tag.
+enum class DataCompression {
+    // the format of earlier versions
+    gzip,
+    // raw deflate primed with a built-in dictionary of the pipeline json keys and scrambler names
+    preset_dictionary,
+    // stored as is, for data that does not compress (binary pipeline metadata)
+    none
+};
+constexpr const uint8_t data_embed_preset_dictionary_tag = 0x02;
+constexpr const uint8_t data_embed_uncompressed_tag = 0x03;
+
+// Channel order of the frames a data band is written to or read from. The scramblers do not care about it, only the
+// bytes of the band do: byte k of a block goes to channel k of an rgb frame (as fed from python) and to channel 2 - k
+// of a bgr frame (as OpenCV decodes video), so both kinds of callers can skip converting whole frames.
+enum class ChannelOrder {
+    rgb,
+    bgr
+};
 
-constexpr const int data_embed_expansion = 4;
+// channel of byte k (0 to 2) of a block
+constexpr int data_embed_channel(ChannelOrder order, int k) {
+    return order == ChannelOrder::rgb ? k : 2 - k;
+}
 
 const int cv_aruco_marker_dict = cv::aruco::DICT_6X6_50;
 const std::array<int, 3> cv_aruco_marker_inds{0,1,2};
@@ -49,28 +79,58 @@ std::vector<uint16_t> decode_metadata(const T* data, int size) {
     return ret;
 }
 
-std::array<int8_t, rs_code_length> rs_encode_block(const char *data, int size);
-std::array<int8_t, rs_data_length> rs_decode_block(const char *data);
-
 
 
 class DataEmbed {
 public:
     using encoded_data_t = std::vector<uint8_t>;
 
+    // a payload rendered once with a timestamp field; frames only re-render the first RS block
+    struct DataBand {
+        std::string header;
+        // everything below the image: the data band with its fiducial markers (at timestamp 0) and the white
+        // half block pads around it
+        cv::Mat image;
+    };
+
     DataEmbed(int block_size, int num_rows, int image_width);
 
     encoded_data_t encode_data(const std::string &data) const;
     cv::Mat DataEmbed::encode_no_data(const cv::Mat &img) const;
+    // the frame is read through the view while it is copied into the output
+    cv::Mat encode_no_data(const FrameView &img) const;
+    // composes into out, which is reallocated only when its size or type does not match; the frame copy is split
+    // over pool
+    void encode_no_data(const FrameView &img, cv::Mat &out, ThreadPool &pool) const;
 
     static std::string decode_data(const encoded_data_t &enc_data);
+    // timestamp is set when the payload carries a timestamp field
+    static std::string decode_data(const encoded_data_t &enc_data, std::optional<size_t> &timestamp);
 
     cv::Mat encoded_data_as_image(const cv::Mat &img, const std::string &data) const;
+    cv::Mat encoded_data_as_image(const FrameView &img, const std::string &data) const;
+    // the data is encoded while the frame is copied
+    void encoded_data_as_image(const FrameView &img, const std::string &data, cv::Mat &out, ThreadPool &pool) const;
+
+    DataBand render_data_band(const std::string &data) const;
+    DataBand render_data_band(const std::string &data, DataCompression compression) const;
+    // copies the cached band and patches the timestamp field, so the payload is not encoded again
+    void encoded_data_as_image(const FrameView &img, const DataBand &band, size_t timestamp, cv::Mat &out,
+                               ThreadPool &pool) const;
+
+    // size of the composed output for an image with the given number of rows
+    cv::Size get_output_size(int image_rows) const;
 
     size_t get_data_region_width() const;
 
     size_t get_data_region_height() const;
 
+    DataCompression get_compression() const;
+    void set_compression(DataCompression compression);
+    // rgb by default; affects frames and bands rendered afterwards
+    ChannelOrder get_channel_order() const;
+    void set_channel_order(ChannelOrder order);
+
 private:
     int _block_size = 0;
     int _num_rows = 0;
@@ -84,11 +144,34 @@ private:
     int _num_bytes_total = 0;
     int _fiducial_marker_size = 0;
     int _fiducial_marker_col_2 = 0;
+    DataCompression _compression = DataCompression::preset_dictionary;
+    ChannelOrder _channel_order = ChannelOrder::rgb;
+    std::array<cv::Mat, 3> _markers;
+    // static parts of the output, blitted into every frame: the top pad, the blank strip below the image and the
+    // top of the right padder with the third marker
+    cv::Mat _top_template;
+    cv::Mat _bottom_template;
+    cv::Mat _marker_column_template;
+
+    // writes the image, the pads and bottom (one of the bottom strips) into out, reallocating out only when its
+    // size does not match, and returns the data band
+    cv::Mat _compose_frame(const FrameView &img, cv::Mat &out, ThreadPool &pool, const cv::Mat &bottom,
+                           bool with_marker) const;
+    // RS codes, expands and pads a payload to the capacity of the band
+    encoded_data_t _encode_payload(const std::string &payload) const;
+    void _draw_markers(cv::Mat &data_band) const;
+    // fills the 3 byte blocks [block_begin, block_end) of the band (row major) one pixel row at a time;
+    // data points to block block_begin
+    void _render_blocks(const uint8_t *data, int block_begin, int block_end, cv::Mat &data_band) const;
 };
 
 std::vector<uint16_t> rs_decode_metadata(const DataEmbed::encoded_data_t &enc_data);
 
-// represent each byte using multiple bytes
+// represent each byte using multiple bytes (expansion is 1, 2 or 4)
 DataEmbed::encoded_data_t expand_representation(const DataEmbed::encoded_data_t &enc_data, int expansion);
 
-DataEmbed::encoded_data_t shrink_representation(const DataEmbed::encoded_data_t &enc_data, int expansion);
\ No newline at end of file
+DataEmbed::encoded_data_t shrink_representation(const DataEmbed::encoded_data_t &enc_data, int expansion);
+
+// same, writing size * expansion (size / expansion) bytes to out
+void expand_representation(const uint8_t *data, size_t size, int expansion, uint8_t *out);
+void shrink_representation(const uint8_t *data, size_t size, int expansion, uint8_t *out);
\ No newline at end of file
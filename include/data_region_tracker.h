@@ -0,0 +1,65 @@
+#pragma once
+
+#include "pipeline.h"
+#include <array>
+
+
+// Keeps the data extraction transform of a video across frames. A full detection (ArUco markers and the block size
+// search of VideoScramblePipeline::get_data_extraction_transform) runs only on the first frame and whenever the
+// transform stops matching; every other frame is verified by sampling the bottom left marker and the metadata header
+// at the positions the transform predicts, a few dozen pixel reads. Frames without a data band (data embed interval
+// above 1) keep the transform.
+class DataRegionTracker {
+public:
+    enum class Status {
+        // no transform for this frame: detection failed
+        lost,
+        // the transform of the previous frame was verified (or the frame carries no data band)
+        tracked,
+        // a full detection ran and found a transform, which may differ from the previous one
+        detected
+    };
+
+    struct Stats {
+        size_t num_frames = 0;
+        size_t num_verified = 0;
+        // frames without a data band that kept the transform
+        size_t num_no_data = 0;
+        size_t num_detections = 0;
+        size_t num_failed_detections = 0;
+    };
+
+    // detector must outlive the tracker
+    explicit DataRegionTracker(const FiducialDetector &detector = get_default_fiducial_detector());
+
+    Status update(const cv::Mat &img);
+    // valid after update() returned tracked or detected
+    const ImageDataTransform &get_transform() const;
+    bool has_transform() const;
+    // forgets the transform, so the next frame runs a full detection
+    void reset();
+    // of the frames passed to update(), rgb by default; a change resets the tracker
+    ChannelOrder get_channel_order() const;
+    void set_channel_order(ChannelOrder order);
+    const Stats &get_stats() const;
+
+private:
+    enum class Verification {
+        match,
+        no_data,
+        mismatch
+    };
+
+    Verification _verify(const cv::Mat &img) const;
+    bool _verify_marker(const cv::Mat &img, bool &blank) const;
+    bool _verify_header(const cv::Mat &img) const;
+
+    const FiducialDetector *_detector;
+    ImageDataTransform _transform;
+    bool _has_transform = false;
+    ChannelOrder _channel_order = ChannelOrder::rgb;
+    cv::Size _frame_size;
+    Stats _stats;
+    // cells of the bottom left marker (including its black border), true for white
+    std::array<bool, 64> _marker_cells{};
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <opencv2/objdetect/aruco_dictionary.hpp>
+#include <opencv2/objdetect/aruco_detector.hpp>
+#include <vector>
+
+
+// Long-lived detector for the fiducial markers of the data embed. The dictionary and the ArUco detector are built
+// once and reused for every frame; detect() does not modify the detector, so one instance can be shared by threads
+// as long as the parameters are not changed concurrently.
+class FiducialDetector {
+public:
+    explicit FiducialDetector(const cv::aruco::DetectorParameters &params = cv::aruco::DetectorParameters());
+
+    const cv::aruco::DetectorParameters &get_detector_parameters() const;
+    void set_detector_parameters(const cv::aruco::DetectorParameters &params);
+
+    void detect(const cv::Mat &img, std::vector<std::vector<cv::Point2f>> &marker_corners,
+                std::vector<int> &marker_inds) const;
+    // Detects the three data embed markers by searching only where the embed puts them: the bottom left and bottom
+    // right corners (the data band) and the top right corner (the padding column) of the frame. Each corner is
+    // searched on a downscaled grayscale copy and every candidate is refined at full resolution in a window around
+    // it. When a marker is not found that way (a frame with the embed somewhere else), the whole frame goes through
+    // detect(), so the result is the same as detect() gives for the markers.
+    void detect_data_markers(const cv::Mat &img, std::vector<std::vector<cv::Point2f>> &marker_corners,
+                             std::vector<int> &marker_inds) const;
+
+private:
+    // finds the markers of cv_aruco_marker_inds in the search corners; false when one is missing
+    bool _detect_in_corners(const cv::Mat &img, std::vector<std::vector<cv::Point2f>> &marker_corners,
+                            std::vector<int> &marker_inds) const;
+
+    cv::aruco::ArucoDetector _detector;
+};
+
+// process wide detector with the default parameters
+FiducialDetector &get_default_fiducial_detector();
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include "thread_pool.h"
+
+
+// A frame described lazily as a base image, an orientation flag and a wrap offset: pixel (y, x) of the view is
+// pixel ((y + offset.y) % rows, (x + offset.x) % cols) of base, or of base^T when transposed. ImageShift and
+// ImageTranspose only update the descriptor; the next step that copies pixels applies both while reading.
+class FrameView {
+public:
+    FrameView() = default;
+    explicit FrameView(const cv::Mat &base);
+
+    cv::Size size() const;
+    int rows() const;
+    int cols() const;
+    int type() const;
+
+    const cv::Mat &base() const;
+    bool is_transposed() const;
+    cv::Point offset() const;
+    // true when base can be used as is
+    bool is_plain() const;
+
+    // out(y, x) = this((y + shift.y) % rows, (x + shift.x) % cols); shift must be normalized
+    FrameView shifted(const cv::Point &shift) const;
+    // out(y, x) = this(x, y)
+    FrameView transposed() const;
+
+    // copies rect (in view coordinates) to out, (re)allocating out only when its size or type does not match;
+    // out may be a ROI of a larger image; large transposed pieces are split over pool
+    void read(const cv::Rect &rect, cv::Mat &out, ThreadPool &pool) const;
+    // copies the whole view to out, split into row bands over pool; out may be a ROI of a larger image
+    void materialize(cv::Mat &out, ThreadPool &pool) const;
+    // base when the view is plain, a materialized copy otherwise
+    cv::Mat to_mat(ThreadPool &pool) const;
+
+private:
+    cv::Mat _base;
+    bool _transposed = false;
+    cv::Point _offset;
+};
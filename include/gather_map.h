@@ -0,0 +1,62 @@
+#pragma once
+
+#include "scrambler.h"
+#include <memory>
+#include <vector>
+
+
+// tile size (in output pixels) used to block the gather for cache locality
+constexpr const int gather_tile_size = 64;
+
+
+// Precomputed pixel gather: pixel (y, x) of the output is read from pixel map(y, x) of the input.
+// The map is stored as CV_16UC2 (x, y) source coordinates, so no image dimension may exceed 65535.
+class GatherMap {
+public:
+    GatherMap() = default;
+
+    // builds the map of a run of static permutation steps by pushing an identity coordinate image through them
+    // (inverse_transform in reverse order if inverse is set), so the result matches the step-by-step path exactly
+    static GatherMap compile(const ScramblerState &state,
+                             const std::vector<std::shared_ptr<ScramblerBase>> &steps,
+                             const cv::Size &input_size,
+                             bool inverse);
+
+    static bool supports_size(const cv::Size &size);
+
+    // out(y, x) = img((m.y + src_offset.y) % h, (m.x + src_offset.x) % w), where m is the map entry at
+    // ((y + dst_offset.y) % H, (x + dst_offset.x) % W); both offsets must already be normalized.
+    // Large outputs are split into bands of tile rows over pool.
+    void apply(const cv::Mat &img, cv::Mat &out, const cv::Point &src_offset, const cv::Point &dst_offset,
+               ThreadPool &pool) const;
+
+    cv::Size input_size() const;
+    cv::Size output_size() const;
+    bool empty() const;
+
+private:
+    cv::Mat _map;
+    cv::Size _input_size;
+};
+
+
+// A run of pixel permutation steps executed as a single gather pass per frame. The run may begin and end with
+// an ImageShift; their timestamp dependent offsets are folded into the gather instead of into the map.
+class FusedPermutation {
+public:
+    FusedPermutation(const ScramblerState &state,
+                     std::shared_ptr<const ImageShift> lead_shift,
+                     const std::vector<std::shared_ptr<ScramblerBase>> &steps,
+                     std::shared_ptr<const ImageShift> trail_shift,
+                     const cv::Size &input_size);
+
+    // a wrap-shifted input view is read in place, a transposed one is materialized first
+    void transform(const ScramblerState &state, const FrameView &img, cv::Mat &out, ThreadPool &pool) const;
+    void inverse_transform(const ScramblerState &state, const FrameView &img, cv::Mat &out, ThreadPool &pool) const;
+
+private:
+    std::shared_ptr<const ImageShift> _lead_shift;
+    std::shared_ptr<const ImageShift> _trail_shift;
+    GatherMap _forward;
+    GatherMap _inverse;
+};
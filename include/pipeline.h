@@ -2,10 +2,91 @@
 
 #include "scrambler.h"
 #include "data_embed.h"
+#include "gather_map.h"
+#include "fiducial_detector.h"
+#include "pipeline_metadata.h"
+#include "pipeline_stats.h"
 #include <memory>
+#include <mutex>
 
 using pipeline_step_t = std::shared_ptr<ScramblerBase>;
 
+// unit of execution of a fitted pipeline: either a single step,
+// or a run of pixel permutation steps fused into one gather pass
+struct PipelineStage {
+    pipeline_step_t step;
+    std::shared_ptr<FusedPermutation> fused;
+    // frame size before and after the stage (in forward direction)
+    cv::Size input_size;
+    cv::Size output_size;
+    // the names of its steps, joined by '+'
+    std::string name;
+};
+
+// Samples the image region of a scrambled frame at its original size in a single pass. A region at scale 1 that lies
+// inside the frame is returned as a ROI of the frame, so the first inverse stage reads the frame in place; any other
+// region goes through one cv::remap that crops, reflects the border (as get_padded_roi) and resizes at once. The maps
+// only depend on the region and the frame size and are rebuilt when either changes.
+class ImageRegionSampler {
+public:
+    // returns a ROI of img or buffer; frames may be at most 32767 pixels wide and high
+    cv::Mat sample(const cv::Mat &img, const cv::Rect &region, const cv::Size &out_size, cv::Mat &buffer,
+                   ThreadPool &pool);
+
+private:
+    void _build_maps(const cv::Rect &region, const cv::Size &frame_size, const cv::Size &out_size);
+
+    cv::Rect _region;
+    cv::Size _frame_size;
+    cv::Size _out_size;
+    // fixed point source positions, nearest neighbour ones at scale 1
+    cv::Mat _map_xy;
+    cv::Mat _map_frac;
+    int _interpolation = cv::INTER_LINEAR;
+};
+
+// Reusable frame buffers for one frame in flight; indices follow the pipeline stages. Stages that only update the
+// frame view leave their buffers empty.
+struct PipelineScratch {
+    std::vector<cv::Mat> forward_buffers;
+    std::vector<cv::Mat> inverse_buffers;
+    // materialized input of a fused stage that is fed a transposed view
+    std::vector<cv::Mat> input_buffers;
+    // the resampled image region of inverse_transform, unused when the region is read in place
+    cv::Mat inverse_input;
+    ImageRegionSampler region_sampler;
+};
+
+// Scratch sets of the reentrant API of one pipeline, freed with it. A frame leases a free set (or a new one) and
+// hands it back when done, so a pipeline holds as many sets as it ever had frames in flight at once.
+class PipelineScratchPool {
+public:
+    class Lease {
+    public:
+        Lease(PipelineScratchPool &pool, PipelineScratch *scratch) : _pool(pool), _scratch(scratch) {}
+        ~Lease() { _pool._release(_scratch); }
+
+        Lease(const Lease &) = delete;
+        Lease &operator=(const Lease &) = delete;
+
+        PipelineScratch &get() { return *_scratch; }
+
+    private:
+        PipelineScratchPool &_pool;
+        PipelineScratch *_scratch;
+    };
+
+    Lease acquire();
+
+private:
+    void _release(PipelineScratch *scratch);
+
+    std::mutex _mutex;
+    std::vector<std::unique_ptr<PipelineScratch>> _sets;
+    // reserved to hold every set, so releasing never allocates
+    std::vector<PipelineScratch *> _free;
+};
+
 struct ImageDataTransform {
     float data_region_x = 0.0f;
     float data_region_y = 0.0f;
@@ -21,6 +102,8 @@ struct ImageDataTransform {
     int original_image_region_height = 0;
     int original_data_region_width = 0;
     int original_data_region_height = 0;
+    // of the frames the transform was detected on and is applied to
+    ChannelOrder channel_order = ChannelOrder::rgb;
 };
 
 
@@ -36,16 +119,82 @@ public:
     void set_timestamp_increment(bool val);
     int get_data_embed_interval() const;
     void set_data_embed_interval(int interval);
+    // compression of the embedded json, the preset dictionary by default; decoding handles every mode
+    DataCompression get_data_compression() const;
+    void set_data_compression(DataCompression compression);
+    // json (the default) or the binary metadata of pipeline_metadata.h, which is embedded uncompressed;
+    // decoding handles both
+    MetadataFormat get_metadata_format() const;
+    void set_metadata_format(MetadataFormat format);
+    // channel order of the frames passed to transform (rgb by default), which the data band is written in; the
+    // frames themselves are scrambled as they are
+    ChannelOrder get_channel_order() const;
+    void set_channel_order(ChannelOrder order);
+    // must be set before fit(); fusion is enabled by default
+    void set_permutation_fusion(bool val);
+    // threads that split the work of each frame (row groups, transpose tiles, RowMix pairs, gathers) and of the
+    // batch calls, the calling thread included. 0 (the default) shares the process wide pool, 1 runs on the
+    // calling thread only, larger values give the pipeline its own work-stealing pool.
+    void set_num_threads(int num_threads);
+    int get_num_threads() const;
+    // timings and byte counts of every stage (forward and inverse), the data embedding, the region extraction and the
+    // final copy of the frames since fit() or reset_stats(); empty unless built with LIBVIDSCRAMBLE_STATS
+    std::vector<StageStats> get_stats() const;
+    void reset_stats();
 
     void fit(const cv::Mat &img);
     cv::Mat transform(const cv::Mat &img);
     cv::Mat inverse_transform(const cv::Mat &img, const ImageDataTransform &info);
+    // write into out, which is reallocated only when its size does not match, and use the scratch buffers of the
+    // pipeline for every intermediate frame, so the steady state does not allocate frame buffers.
+    // out must not share data with img.
+    void transform_into(const cv::Mat &img, cv::Mat &out);
+    void inverse_transform_into(const cv::Mat &img, const ImageDataTransform &info, cv::Mat &out);
+
+    // Reentrant variants: the frame is processed at the given timestamp and the pipeline is not modified, so once
+    // fit, one pipeline can be shared by any number of threads (as long as nothing calls fit, sync_state or a setter
+    // concurrently). Intermediate frames go to scratch buffers the pipeline leases to each frame in flight.
+    cv::Mat transform(const cv::Mat &img, size_t timestamp) const;
+    cv::Mat inverse_transform(const cv::Mat &img, const ImageDataTransform &info, size_t timestamp) const;
+    void transform_into(const cv::Mat &img, size_t timestamp, cv::Mat &out) const;
+    void inverse_transform_into(const cv::Mat &img, const ImageDataTransform &info, size_t timestamp,
+                                cv::Mat &out) const;
+
+    // frame i is processed with timestamp start_timestamp + i, so outputs (and data frames) match the sequential
+    // calls; frames are distributed over the default thread pool. The pipeline timestamp is left untouched.
+    std::vector<cv::Mat> transform_batch(const std::vector<cv::Mat> &frames, size_t start_timestamp) const;
+    std::vector<cv::Mat> inverse_transform_batch(const std::vector<cv::Mat> &frames, const ImageDataTransform &info,
+                                                 size_t start_timestamp) const;
+    // out is resized to the number of frames; like transform_into, frames that already have the right size are
+    // written in place
+    void transform_batch_into(const std::vector<cv::Mat> &frames, size_t start_timestamp,
+                              std::vector<cv::Mat> &out) const;
+    void inverse_transform_batch_into(const std::vector<cv::Mat> &frames, const ImageDataTransform &info,
+                                      size_t start_timestamp, std::vector<cv::Mat> &out) const;
+    // size of the frames fit was called with, which inverse_transform returns
+    cv::Size get_input_size() const;
+    // size of the frames transform returns, data band included
+    cv::Size get_output_size() const;
     void sync_state(const nlohmann::json &data);
     void sync_state(const std::string &data);
+    void sync_state(const ScramblerState &state);
 
+    // uses the process wide detector
     static bool get_data_extraction_transform(const cv::Mat &img, ImageDataTransform &info);
+    // detector should be kept across frames, it is expensive to construct
+    static bool get_data_extraction_transform(const cv::Mat &img, ImageDataTransform &info,
+                                              const FiducialDetector &detector);
+    // for frames in the given channel order, which is kept in info for extract_data
+    static bool get_data_extraction_transform(const cv::Mat &img, ImageDataTransform &info,
+                                              const FiducialDetector &detector, ChannelOrder channel_order);
+    // the embedded description as to_json() text, whichever format it was embedded in
     static std::string extract_data(const cv::Mat &img, const ImageDataTransform &info);
+    // same, parsed; binary metadata is decoded without a json round trip
+    static void extract_metadata(const cv::Mat &img, const ImageDataTransform &info, PipelineMetadata &metadata);
     static cv::Mat extract_image_region(const cv::Mat &img, const ImageDataTransform &info);
+    // padded_buffer holds the border padded region when the region reaches past the image
+    static void extract_image_region(const cv::Mat &img, const ImageDataTransform &info,
+                                     cv::Mat &padded_buffer, cv::Mat &out);
 
     std::string to_json() const;
     cv::Mat to_json_image() const;
@@ -54,17 +203,50 @@ public:
 private:
 
     void _assert_fit() const;
+    void _build_stages(const std::vector<cv::Size> &step_input_sizes);
+    void _assert_no_alias(const cv::Mat &img, const cv::Mat &out) const;
+    void _allocate_scratch(PipelineScratch &scratch) const;
+    ThreadPool &_get_thread_pool() const;
+
+    // one frame at an explicit timestamp; touches nothing but scratch and out
+    void _transform_frame(const cv::Mat &img, size_t timestamp, PipelineScratch &scratch, cv::Mat &out) const;
+    void _inverse_transform_frame(const cv::Mat &img, const ImageDataTransform &info, size_t timestamp,
+                                  PipelineScratch &scratch, cv::Mat &out) const;
+    // to_json() without the timestamp, which data frames carry in a separate field
+    nlohmann::ordered_json _to_json_object() const;
+    PipelineMetadata _to_metadata() const;
+    void _update_data_band();
+    // the payload of the data band and its timestamp field, if there is one
+    static std::string _extract_payload(const cv::Mat &img, const ImageDataTransform &info,
+                                        std::optional<size_t> &timestamp);
 
     std::shared_ptr<std::vector<pipeline_step_t>> _steps;
+    std::vector<PipelineStage> _stages;
     ScramblerState _state;
     bool _transform_increment_timestamp = true;
+    bool _permutation_fusion = true;
     bool _fit = false;
 
     int _data_embed_block_size = 0;
     int _data_embed_num_rows = 0;
     int _data_embed_interval = 1;
+    DataCompression _data_compression = DataCompression::preset_dictionary;
+    MetadataFormat _metadata_format = MetadataFormat::json;
+    ChannelOrder _channel_order = ChannelOrder::rgb;
 
     std::unique_ptr<DataEmbed> _data_embed;
+    // rendered _to_json_object() (or binary metadata) payload, patched with the timestamp on every data frame
+    DataEmbed::DataBand _data_band;
+    std::string _data_band_payload;
+
+    // buffers of the stateful API
+    PipelineScratch _scratch;
+    // buffers of the reentrant API
+    mutable PipelineScratchPool _scratch_pool;
+    // null for the process wide pool
+    std::shared_ptr<ThreadPool> _thread_pool;
+    // null unless built with LIBVIDSCRAMBLE_STATS
+    std::shared_ptr<PipelineStatsRecorder> _stats;
 };
 
 
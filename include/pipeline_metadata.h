@@ -0,0 +1,52 @@
+#pragma once
+
+#include "scrambler.h"
+#include <array>
+
+
+// Binary form of the information in VideoScramblePipeline::to_json(), for a data band that holds a few dozen bytes
+// instead of the json text. Layout:
+//   magic (2 bytes), version (1 byte),
+//   varints: data_embed_block_size, data_embed_num_rows, data_embed_interval, output_width_wo_data,
+//            output_height_wo_data, data_region_width, data_region_height, input_width, input_height,
+//            number of steps,
+//   per step: type id (1 byte) and its parameters as zigzag varints,
+//   CRC-32 of everything before it (4 bytes, little endian).
+// The timestamp is not part of it, data frames carry it in the timestamp field of the band.
+constexpr const std::array<uint8_t, 2> pipeline_metadata_magic{0xB5, 0x5C};
+constexpr const uint8_t pipeline_metadata_version = 1;
+constexpr const int pipeline_metadata_max_steps = 64;
+constexpr const int pipeline_metadata_max_params = 2;
+
+// how a pipeline embeds its description
+enum class MetadataFormat {
+    json,
+    binary
+};
+
+struct PipelineMetadata {
+    struct Step {
+        ScramblerType type = ScramblerType::ImageTranspose;
+        // in the order of the constructor arguments
+        std::array<int, pipeline_metadata_max_params> params{};
+    };
+
+    int data_embed_block_size = 0;
+    int data_embed_num_rows = 0;
+    int data_embed_interval = 1;
+    ScramblerState state;
+    std::array<Step, pipeline_metadata_max_steps> steps;
+    int num_steps = 0;
+};
+
+// whether the payload starts like binary metadata (json starts with '{')
+bool is_binary_pipeline_metadata(const char *data, size_t size);
+
+std::string encode_pipeline_metadata(const PipelineMetadata &metadata);
+// parses without allocating; returns false on a wrong magic, unknown version or step type, bad CRC or a truncated
+// record. The timestamp of the state is left alone.
+bool decode_pipeline_metadata(const char *data, size_t size, PipelineMetadata &metadata);
+
+// the json object of VideoScramblePipeline::to_json() and back; the key order matches to_json()
+nlohmann::ordered_json pipeline_metadata_to_json(const PipelineMetadata &metadata);
+void pipeline_metadata_from_json(const nlohmann::ordered_json &data, PipelineMetadata &metadata);
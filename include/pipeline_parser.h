@@ -6,3 +6,5 @@
 
 
 std::shared_ptr<VideoScramblePipeline> build_pipeline_from_json(const std::string &json_str);
+// the pipeline described by metadata (state aside, which fit() and sync_state() restore)
+std::shared_ptr<VideoScramblePipeline> build_pipeline_from_metadata(const PipelineMetadata &metadata);
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+// Per stage instrumentation of VideoScramblePipeline. The pipeline only records when the library is built with
+// LIBVIDSCRAMBLE_STATS; otherwise the recording code is compiled out and get_stats() stays empty.
+#if defined(LIBVIDSCRAMBLE_STATS)
+constexpr const bool pipeline_stats_enabled = true;
+#else
+constexpr const bool pipeline_stats_enabled = false;
+#endif
+
+// latency histogram: four buckets per power of two of nanoseconds, up to about 4 s
+constexpr const int stats_latency_buckets = 128;
+
+struct StageStats {
+    // the steps of the stage joined by '+', or one of the fixed stages (data embedding, region extraction, ...)
+    std::string name;
+    bool inverse = false;
+    size_t num_calls = 0;
+    double total_ms = 0.0;
+    double min_ms = 0.0;
+    double max_ms = 0.0;
+    // upper bound of the histogram bucket holding the 99th percentile, within 25%
+    double p99_ms = 0.0;
+    // pixel bytes the stage copied; steps that only update the frame view move none
+    size_t bytes_read = 0;
+    size_t bytes_written = 0;
+    // times the data pointer of the stage's frame buffer changed (cv::Mat::create() had to reallocate it); other heap
+    // allocations of the stage are not counted
+    size_t buffer_reallocations = 0;
+};
+
+// Counters of a fixed set of stages. Every thread records into its own counters, which only it writes, so recording
+// takes no lock and no atomic read-modify-write; get() sums the counters of all threads. A thread registers (under a
+// lock) on its first frame of a recorder. reset() while frames are in flight may keep a part of their counts.
+class PipelineStatsRecorder {
+public:
+    struct Stage {
+        std::string name;
+        bool inverse;
+    };
+
+    class ThreadCounters {
+    public:
+        explicit ThreadCounters(size_t num_stages);
+
+        void record(size_t stage, std::chrono::steady_clock::duration elapsed, size_t bytes_read,
+                    size_t bytes_written, bool reallocated);
+
+    private:
+        friend class PipelineStatsRecorder;
+
+        struct Counters {
+            std::atomic<uint64_t> num_calls{0};
+            std::atomic<uint64_t> total_ns{0};
+            std::atomic<uint64_t> min_ns{UINT64_MAX};
+            std::atomic<uint64_t> max_ns{0};
+            std::atomic<uint64_t> bytes_read{0};
+            std::atomic<uint64_t> bytes_written{0};
+            std::atomic<uint64_t> buffer_reallocations{0};
+            std::array<std::atomic<uint64_t>, stats_latency_buckets> latency{};
+        };
+
+        std::unique_ptr<Counters[]> _counters;
+    };
+
+    explicit PipelineStatsRecorder(std::vector<Stage> stages);
+
+    // counters of the calling thread
+    ThreadCounters &local();
+    std::vector<StageStats> get() const;
+    void reset();
+
+private:
+    const uint64_t _id;
+    const std::vector<Stage> _stages;
+    mutable std::mutex _mutex;
+    // shared with the thread local registries, which drop them once the recorder is gone
+    std::vector<std::shared_ptr<ThreadCounters>> _threads;
+};
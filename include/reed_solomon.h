@@ -0,0 +1,39 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+
+/* Reed Solomon Code Parameters */
+constexpr const size_t rs_code_length = 15;
+constexpr const size_t rs_fec_length  = 3;
+constexpr const size_t rs_data_length = rs_code_length - rs_fec_length;
+
+/* Finite Field Parameters */
+constexpr const size_t field_descriptor                =   4;
+constexpr const size_t generator_polynomial_index      = 0;
+constexpr const size_t generator_polynomial_root_count =  rs_fec_length;
+// x^4 + x + 1
+constexpr const unsigned int rs_primitive_polynomial = 0x13;
+
+
+// Systematic RS(15, 12) code over GF(2^4) with the generator roots alpha^0 .. alpha^2, bit compatible with the
+// schifra codec used before: every byte holds one symbol in its low nibble, the high nibbles are passed through
+// unprotected and the fec bytes are plain symbols. All tables are built at compile time, so the codec has no state
+// and can be used from any number of threads.
+
+// number of bytes rs_encode_blocks writes for size data bytes
+size_t rs_encoded_size(size_t size);
+
+// codes [data, data + size) in blocks of rs_data_length bytes, zero padding the last one, and writes
+// rs_encoded_size(size) bytes to out
+void rs_encode_blocks(const char *data, size_t size, int8_t *out);
+
+// decodes num_blocks consecutive code blocks into num_blocks * rs_data_length bytes, correcting one symbol error
+// per block; throws when a block has more errors than that
+void rs_decode_blocks(const int8_t *enc, size_t num_blocks, int8_t *out);
+
+// single block versions
+std::array<int8_t, rs_code_length> rs_encode_block(const char *data, int size);
+std::array<int8_t, rs_data_length> rs_decode_block(const char *data);
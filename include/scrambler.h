@@ -8,11 +8,26 @@
 #include <vector>
 #include <random>
 #include "util.h"
+#include "frame_view.h"
 #include <nlohmann/json.hpp>
 
 
 using random_geneator_t = std::mt19937;
 
+enum class ScramblerType {
+    ImageTranspose,
+    RowShuffle,
+    RowMix,
+    ImageShift
+};
+
+// whether the scrambler only moves pixels around without depending on the timestamp;
+// runs of such steps can be fused into a single gather pass (see gather_map.h)
+bool is_static_permutation(ScramblerType type);
+
+// whether transform_view of the scrambler only updates the view descriptor without touching pixels
+bool is_view_only(ScramblerType type);
+
 struct ScramblerState{
     size_t timestamp = 0;
     size_t output_width_wo_data = 0;
@@ -28,9 +43,19 @@ class ScramblerBase {
 public:
     explicit ScramblerBase() : _fit(false) {}
     virtual void fit(ScramblerState &state, const cv::Mat &img) = 0;
-    virtual cv::Mat transform(ScramblerState &state, const cv::Mat &img) const = 0;
-    virtual cv::Mat inverse_transform(ScramblerState &state, const cv::Mat &img) const = 0;
+    virtual cv::Mat transform(const ScramblerState &state, const cv::Mat &img) const = 0;
+    virtual cv::Mat inverse_transform(const ScramblerState &state, const cv::Mat &img) const = 0;
     virtual nlohmann::json to_json() const = 0;
+    virtual ScramblerType type() const = 0;
+
+    // lazy variants used by the pipeline: steps that only reorient or wrap the frame return an updated view,
+    // the others read through the view while writing their output into buffer, which is reused across frames
+    // (reallocated only when its size or type does not match). The default materializes the view first.
+    // Pixel work is split over pool.
+    virtual FrameView transform_view(const ScramblerState &state, const FrameView &img, cv::Mat &buffer,
+                                     ThreadPool &pool) const;
+    virtual FrameView inverse_transform_view(const ScramblerState &state, const FrameView &img, cv::Mat &buffer,
+                                             ThreadPool &pool) const;
 protected:
 
     void _assert_fit() const {
@@ -46,9 +71,14 @@ protected:
 class ImageTranspose : public ScramblerBase {
 public:
     void fit(ScramblerState &state, const cv::Mat &img) override;
-    cv::Mat transform(ScramblerState &state, const cv::Mat &img) const override;
-    cv::Mat inverse_transform(ScramblerState &state, const cv::Mat &img) const override;
+    cv::Mat transform(const ScramblerState &state, const cv::Mat &img) const override;
+    cv::Mat inverse_transform(const ScramblerState &state, const cv::Mat &img) const override;
     nlohmann::json to_json() const override;
+    ScramblerType type() const override { return ScramblerType::ImageTranspose; }
+    FrameView transform_view(const ScramblerState &state, const FrameView &img, cv::Mat &buffer,
+                             ThreadPool &pool) const override;
+    FrameView inverse_transform_view(const ScramblerState &state, const FrameView &img, cv::Mat &buffer,
+                                     ThreadPool &pool) const override;
 };
 
 
@@ -58,10 +88,18 @@ public:
     explicit RowShuffle(int row_group_size, int random_seed=0);
 
     void fit(ScramblerState &state, const cv::Mat &img) override;
-    cv::Mat transform(ScramblerState &state, const cv::Mat &img) const override;
-    cv::Mat inverse_transform(ScramblerState &state, const cv::Mat &img) const override;
+    cv::Mat transform(const ScramblerState &state, const cv::Mat &img) const override;
+    cv::Mat inverse_transform(const ScramblerState &state, const cv::Mat &img) const override;
     nlohmann::json to_json() const override;
+    ScramblerType type() const override { return ScramblerType::RowShuffle; }
+    FrameView transform_view(const ScramblerState &state, const FrameView &img, cv::Mat &buffer,
+                             ThreadPool &pool) const override;
+    FrameView inverse_transform_view(const ScramblerState &state, const FrameView &img, cv::Mat &buffer,
+                                     ThreadPool &pool) const override;
 private:
+
+    void _transform_impl(const FrameView &img, bool inverse, cv::Mat &out, ThreadPool &pool) const;
+
     int _row_group_size = 0;
     int _random_seed = 0;
     int _pad = 0;
@@ -77,12 +115,18 @@ public:
     explicit RowMix(int row_group_size, int random_seed);
 
     void fit(ScramblerState &state, const cv::Mat &img) override;
-    cv::Mat transform(ScramblerState &state, const cv::Mat &img) const override;
-    cv::Mat inverse_transform(ScramblerState &state, const cv::Mat &img) const override;
+    cv::Mat transform(const ScramblerState &state, const cv::Mat &img) const override;
+    cv::Mat inverse_transform(const ScramblerState &state, const cv::Mat &img) const override;
     nlohmann::json to_json() const override;
+    ScramblerType type() const override { return ScramblerType::RowMix; }
+    FrameView transform_view(const ScramblerState &state, const FrameView &img, cv::Mat &buffer,
+                             ThreadPool &pool) const override;
+    FrameView inverse_transform_view(const ScramblerState &state, const FrameView &img, cv::Mat &buffer,
+                                     ThreadPool &pool) const override;
 private:
 
-    cv::Mat _transform_impl(ScramblerState &state, const cv::Mat &img, bool inverse) const;
+    void _transform_impl(const ScramblerState &state, const FrameView &img, bool inverse, cv::Mat &out,
+                         ThreadPool &pool) const;
 
     int _random_seed = 0;
     int _row_group_size = 0;
@@ -97,9 +141,17 @@ public:
     explicit ImageShift(int sx, int sy);
 
     void fit(ScramblerState &state, const cv::Mat &img) override;
-    cv::Mat transform(ScramblerState &state, const cv::Mat &img) const override;
-    cv::Mat inverse_transform(ScramblerState &state, const cv::Mat &img) const override;
+    cv::Mat transform(const ScramblerState &state, const cv::Mat &img) const override;
+    cv::Mat inverse_transform(const ScramblerState &state, const cv::Mat &img) const override;
     nlohmann::json to_json() const override;
+    ScramblerType type() const override { return ScramblerType::ImageShift; }
+    FrameView transform_view(const ScramblerState &state, const FrameView &img, cv::Mat &buffer,
+                             ThreadPool &pool) const override;
+    FrameView inverse_transform_view(const ScramblerState &state, const FrameView &img, cv::Mat &buffer,
+                                     ThreadPool &pool) const override;
+
+    // normalized wrap offset applied by transform (or inverse_transform) to an image of the given size
+    cv::Point get_offset(const ScramblerState &state, const cv::Size &size, bool inverse) const;
 private:
     int _sx = 0;
     int _sy = 0;
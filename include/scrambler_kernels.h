@@ -0,0 +1,48 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include "frame_view.h"
+#include "thread_pool.h"
+
+
+// frames smaller than this many bytes are processed on the calling thread only
+constexpr const size_t kernel_parallel_min_bytes = 1 << 21;
+
+
+// Moves row group i of src to row group perm[i] of dst (inverse: row group perm[i] of src to row group i of dst).
+// Rows past the end of src are read as BORDER_REFLECT padding and rows past the end of dst are dropped, so the
+// padded frame never has to be materialized. dst must already be allocated with the type and width of src.
+void row_group_shuffle(const cv::Mat &src, cv::Mat &dst, const std::vector<int> &perm, int row_group_size,
+                       bool inverse, ThreadPool &pool);
+// same, reading the source rows through a lazily transposed / shifted view
+void row_group_shuffle(const FrameView &src, cv::Mat &dst, const std::vector<int> &perm, int row_group_size,
+                       bool inverse, ThreadPool &pool);
+
+
+// RowMix on uint8 data, identical to the former CV_16S implementation:
+// forward maps (r0, r1) to sum = round((r0 + r1) / 2) and diff = round((r0 - r1) / 2) mod 256 (ties to even),
+// inverse maps (sum, diff) to saturate(sum + (int8_t)diff) and saturate(sum - (int8_t)diff)
+void row_mix_forward(const uchar *row0, const uchar *row1, uchar *sum, uchar *diff, size_t n);
+void row_mix_inverse(const uchar *sum, const uchar *diff, uchar *row0, uchar *row1, size_t n);
+
+// Mixes row i with row i + rows / 2; the sum goes to row i of the permuted row groups and the difference
+// to row i + rows / 2 of the permuted row groups (inverse reads them back). dst must not alias src.
+void row_mix(const cv::Mat &src, cv::Mat &dst, const std::vector<int> &perm, int row_group_size,
+             bool inverse, ThreadPool &pool);
+
+// number of row pairs of a non-plain view gathered into a scratch block before they are mixed
+constexpr const int row_mix_view_block_size = 16;
+
+// same, reading the source rows through a lazily transposed / shifted view
+void row_mix(const FrameView &src, cv::Mat &dst, const std::vector<int> &perm, int row_group_size,
+             bool inverse, ThreadPool &pool);
+
+
+// side length in pixels of the cache blocks transpose_into works on
+constexpr const int transpose_tile_size = 64;
+
+// dst = src^T. CV_8UC1 and CV_8UC3 go through cache-blocked SIMD tile transposes, other types fall back to
+// cv::transpose. dst is (re)allocated only when its size or type does not match, so a caller-provided buffer is
+// written in place; it must not alias src.
+void transpose_into(const cv::Mat &src, cv::Mat &dst, ThreadPool &pool);
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+
+// Bounded single producer / single consumer ring buffer. try_push and try_pop never lock; push and pop spin on them,
+// yielding and then sleeping briefly, while the queue is full or empty. close() ends the stream: pop drains what is
+// queued and then returns false, push returns false right away, so either side can stop the other.
+template<typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity) : _slots(capacity + 1) {}
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    // moves from item only on success
+    bool try_push(T &item) {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        const size_t next = _next(tail);
+        if (next == _head.load(std::memory_order_acquire)) {
+            return false;
+        }
+        _slots[tail] = std::move(item);
+        _tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool try_pop(T &item) {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = std::move(_slots[head]);
+        _head.store(_next(head), std::memory_order_release);
+        return true;
+    }
+
+    // false when the queue is closed
+    bool push(T item) {
+        for(int spins = 0; !_closed.load(std::memory_order_acquire); ++spins) {
+            if (try_push(item)) {
+                return true;
+            }
+            _backoff(spins);
+        }
+        return false;
+    }
+
+    // false when the queue is closed and drained
+    bool pop(T &item) {
+        for(int spins = 0;; ++spins) {
+            if (try_pop(item)) {
+                return true;
+            }
+            // items pushed before close() are visible once the flag is
+            if (_closed.load(std::memory_order_acquire)) {
+                return try_pop(item);
+            }
+            _backoff(spins);
+        }
+    }
+
+    void close() {
+        _closed.store(true, std::memory_order_release);
+    }
+
+    bool is_closed() const {
+        return _closed.load(std::memory_order_acquire);
+    }
+
+private:
+    size_t _next(size_t i) const {
+        return i + 1 == _slots.size() ? 0 : i + 1;
+    }
+
+    // a stage waiting for a frame usually waits for a whole frame time, so the spinning gives way to short sleeps
+    static void _backoff(int spins) {
+        if (spins < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+    std::vector<T> _slots;
+    // _head is written by the consumer only, _tail by the producer only
+    alignas(64) std::atomic<size_t> _head{0};
+    alignas(64) std::atomic<size_t> _tail{0};
+    std::atomic<bool> _closed{false};
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+
+// Non-owning reference to a callable taking (chunk_begin, chunk_end), so passing a lambda to parallel_for does not
+// allocate. It is only valid while the callable lives, which a parallel_for call always is.
+class ChunkFunctionRef {
+public:
+    template<typename Fn, typename = std::enable_if_t<!std::is_same<std::decay_t<Fn>, ChunkFunctionRef>::value>>
+    ChunkFunctionRef(Fn &&fn)
+        : _fn((void *)std::addressof(fn)),
+          _call([](void *fn, int begin, int end) { (*(std::remove_reference_t<Fn> *)fn)(begin, end); }) {}
+
+    void operator()(int begin, int end) const {
+        _call(_fn, begin, end);
+    }
+
+private:
+    void *_fn;
+    void (*_call)(void *, int, int);
+};
+
+
+// Work-stealing pool: every worker owns a task deque, parallel_for pushes its chunks onto the deque of the calling
+// thread (threads outside the pool share one), the owner takes tasks from the back and idle threads steal from the
+// front of the other deques. Once the deques have grown to the deepest nesting seen, parallel_for does not allocate.
+class ThreadPool {
+public:
+    // num_threads counts the calling thread, which always takes part in parallel_for;
+    // values below 1 select the number of hardware threads
+    explicit ThreadPool(int num_threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    int get_num_threads() const;
+
+    // splits [begin, end) into chunks of at least min_chunk items and runs fn(chunk_begin, chunk_end) on them;
+    // returns when every chunk is done. Safe to call from inside a running chunk.
+    void parallel_for(int begin, int end, ChunkFunctionRef fn, int min_chunk = 1);
+
+private:
+    // the state of one parallel_for call, on the stack of its caller
+    struct Job;
+
+    struct Task {
+        Job *job;
+        int begin;
+        int end;
+    };
+
+    // ring buffer that only grows, so the steady state pushes and pops without allocating
+    struct TaskQueue {
+        std::mutex mutex;
+        std::vector<Task> ring;
+        size_t head = 0;
+        size_t size = 0;
+
+        void push_back(const Task &task);
+        Task pop_back();
+        Task pop_front();
+    };
+
+    // deque of the calling thread: its own for a worker of this pool, the shared one (0) otherwise
+    size_t _own_queue() const;
+    // own deque first (newest task), then the oldest task of the other deques
+    bool _pop_task(size_t queue, Task &task);
+    void _run_task(const Task &task);
+    void _worker_loop(size_t queue);
+
+    // _queues[0] is shared by threads outside the pool, _queues[i] belongs to worker i
+    std::vector<std::unique_ptr<TaskQueue>> _queues;
+    std::vector<std::thread> _workers;
+    // tasks in all deques; idle threads sleep on _sleep_cv while it is zero
+    std::atomic<int> _num_queued{0};
+    std::mutex _sleep_mutex;
+    std::condition_variable _sleep_cv;
+    bool _stop = false;
+};
+
+// process wide pool shared by the scrambler kernels
+ThreadPool &get_default_thread_pool();
@@ -23,4 +23,7 @@ std::string get_opencv_mat_dt_string(OpenCVMatDT v);
 
 OpenCVMatDataInfo get_opencv_mat_data_info(int type);
 
+// maps a (possibly negative) wrap offset into [0, w) x [0, h), using the same rules as translate_wrap
+cv::Point normalize_wrap_offset(int sx, int sy, int w, int h);
+
 cv::Mat translate_wrap(const cv::Mat& input, int sx, int sy);
\ No newline at end of file
@@ -1,31 +1,14 @@
 #include "data_embed.h"
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <zlib.h>
 
-#include <schifra_galois_field.hpp>
-#include <schifra_galois_field_polynomial.hpp>
-#include <schifra_sequential_root_generator_polynomial_creator.hpp>
-#include <schifra_reed_solomon_encoder.hpp>
-#include <schifra_reed_solomon_decoder.hpp>
-#include <schifra_reed_solomon_block.hpp>
-#include <schifra_error_processes.hpp>
-#include <schifra_reed_solomon_block.hpp>
-#include <schifra_reed_solomon_bitio.hpp>
-
-
-
-class ReedSolomon {
-public:
-    /* Instantiate Encoder and Decoder (Codec) */
-    using rs_encoder_t = schifra::reed_solomon::encoder<rs_code_length,rs_fec_length,rs_data_length>;
-    using rs_decoder_t = schifra::reed_solomon::decoder<rs_code_length,rs_fec_length,rs_data_length>;
-    using rs_block_t = schifra::reed_solomon::block<rs_code_length, rs_fec_length>;
-
-    std::unique_ptr<rs_encoder_t> _rs_encoder;
-    std::unique_ptr<rs_decoder_t> _rs_decoder;
-    std::unique_ptr<schifra::galois::field> _rs_field;
-    std::unique_ptr<schifra::galois::field_polynomial> _rs_field_poly;
-};
-
+#if defined(LIBVIDSCRAMBLE_AVX2)
+#include <immintrin.h>
+#elif defined(LIBVIDSCRAMBLE_SSE41)
+#include <smmintrin.h>
+#endif
 
 std::string encode_metadata(std::initializer_list<uint16_t> data) {
     std::string ret(data.size() * 2, 0x00);
@@ -40,100 +23,15 @@ std::string encode_metadata(std::initializer_list<uint16_t> data) {
 }
 
 
-ReedSolomon &get_rs_impl() {
-    static std::unique_ptr<ReedSolomon> rs_impl;
-    if(!rs_impl) {
-        rs_impl = std::make_unique<ReedSolomon>();
-        rs_impl->_rs_field = std::make_unique<schifra::galois::field>(field_descriptor,
-                                                                                 schifra::galois::primitive_polynomial_size01,
-                                                                                 schifra::galois::primitive_polynomial01);
-
-        rs_impl->_rs_field_poly = std::make_unique<schifra::galois::field_polynomial>(*rs_impl->_rs_field);
-
-        if (
-                !schifra::make_sequential_root_generator_polynomial(*rs_impl->_rs_field,
-                                                                    generator_polynomial_index,
-                                                                    generator_polynomial_root_count,
-                                                                    *rs_impl->_rs_field_poly)
-                )
-        {
-            throw std::runtime_error{"failed to create sequential root generator"};
-        }
-
-        /* Instantiate Finite Field and Generator Polynomials */
-
-        rs_impl->_rs_encoder = std::make_unique<ReedSolomon::rs_encoder_t>(*rs_impl->_rs_field, *rs_impl->_rs_field_poly);
-        rs_impl->_rs_decoder = std::make_unique<ReedSolomon::rs_decoder_t>(*rs_impl->_rs_field, generator_polynomial_index);
-    }
-
-    return *rs_impl;
-}
-
-std::array<int8_t, rs_code_length> rs_encode_block(const char *data, int size) {
-    static ReedSolomon::rs_block_t block;
-
-
-    if (size > rs_data_length) {
-        throw std::runtime_error{"invalid data size"};
-    }
-    std::copy(data, data + size, block.data);
-    for(auto j = size; j < rs_data_length; ++j) {
-        block.data[j] = 0x00;
-    }
-
-    // start encoding
-    if(!get_rs_impl()._rs_encoder->encode(block)) {
-        throw std::runtime_error{format("an error occurred during reed solomon encode: {}", block.error_as_string())};
-    }
-
-    std::array<int8_t, rs_code_length> ret;
-
-    for(auto j = 0; j < rs_data_length; ++j) {
-        ret[j] = block.data[j] & 0xFF;
-    }
-
-    for(auto j = 0; j < rs_fec_length; ++j) {
-        ret[j+rs_data_length] = block.fec(j) & 0xFF;
-    }
-
-    return ret;
-}
-
-std::array<int8_t, rs_data_length> rs_decode_block(const char *data) {
-    static ReedSolomon::rs_block_t block;
-    std::copy(data, data+rs_code_length, block.data);
-
-    if(!get_rs_impl()._rs_decoder->decode(block)) {
-        throw std::runtime_error{format("an error occurred during reed solomon decode: {}", block.error_as_string())};
-    }
-
-    std::array<int8_t, rs_data_length> ret;
-    std::copy(block.data, block.data + rs_data_length, ret.data());
-    return ret;
-}
-
 std::vector<uint16_t> rs_decode_metadata(const DataEmbed::encoded_data_t &enc_data) {
     // decode metadata blocks
     constexpr const int metadata_size = 6;
-    std::vector<char> metadata_buf;
-    metadata_buf.reserve(2 * metadata_size);
-    std::array<char, rs_code_length> code_buf;
-
-
-
-    int decoded_size = 0, block_id = 0;
-    while(decoded_size < metadata_size) {
-        const int s = block_id * rs_code_length;
-        if (s + rs_code_length > enc_data.size()) {
-            throw std::runtime_error{"end of encoded data reached before fully decoding the data"};
-        }
-        std::copy(enc_data.data() + s, enc_data.data() + s + rs_code_length, code_buf.data());
-        auto decoded_buf = rs_decode_block(code_buf.data());
-        std::copy(decoded_buf.begin(), decoded_buf.end(), std::back_inserter(metadata_buf));
-
-        decoded_size += rs_data_length;
-        ++block_id;
+    constexpr const size_t num_blocks = (metadata_size + rs_data_length - 1) / rs_data_length;
+    if (num_blocks * rs_code_length > enc_data.size()) {
+        throw std::runtime_error{"end of encoded data reached before fully decoding the data"};
     }
+    std::array<int8_t, num_blocks * rs_data_length> metadata_buf;
+    rs_decode_blocks(reinterpret_cast<const int8_t*>(enc_data.data()), num_blocks, metadata_buf.data());
 
     return decode_metadata(metadata_buf.data(), metadata_size);
 }
@@ -175,36 +73,132 @@ DataEmbed::DataEmbed(int block_size, int num_rows, int image_width) : _block_siz
     _num_bytes_total = _num_bytes_per_row * _num_rows;
     _num_bits_total = _num_bytes_total * 8;
 
+    // the markers never change, render them once
+    auto aruco_dict = cv::aruco::getPredefinedDictionary(cv_aruco_marker_dict);
+    for(auto i = 0; i < _markers.size(); ++i) {
+        cv::Mat marker;
+        cv::aruco::generateImageMarker(aruco_dict, cv_aruco_marker_inds[i], _fiducial_marker_size, marker);
+        cv::cvtColor(marker, _markers[i], cv::COLOR_GRAY2BGR);
+    }
+
+    const cv::Vec3b white(255, 255, 255);
+    _top_template.create(data_embed_top_pad_rows, _image_width_with_marker, CV_8UC3);
+    _top_template.setTo(white);
+    _bottom_template.create(_block_size / 2 + _num_rows * _block_size + _block_size / 2, _image_width_with_marker, CV_8UC3);
+    _bottom_template.setTo(white);
+    _marker_column_template.create(_fiducial_marker_size, _image_width_with_marker - _image_width, CV_8UC3);
+    _marker_column_template.setTo(white);
+    _markers[2].copyTo(_marker_column_template(cv::Rect(_block_size/2, 0, _fiducial_marker_size, _fiducial_marker_size)));
+
+}
+
+
+// The pipeline json as to_json writes it, most frequent parts last (they are the closest matches for deflate).
+static const char data_embed_preset_dictionary[] =
+        "{\"name\":\"ImageTranspose\"}"
+        "{\"name\":\"ImageShift\",\"sx\":0,\"sy\":0}"
+        "{\"name\":\"RowMix\",\"random_seed\":"
+        "{\"name\":\"RowShuffle\",\"random_seed\":"
+        ",\"row_group_size\":"
+        "{\"steps\":[{\"name\":\""
+        "}],\"data_embed_block_size\":,\"data_embed_num_rows\":,\"data_embed_interval\":"
+        ",\"state\":{\"output_width_wo_data\":,\"output_height_wo_data\":"
+        ",\"data_region_width\":,\"data_region_height\":"
+        ",\"input_height\":,\"input_width\":";
+
+// a preset dictionary stream is the tag followed by raw deflate data primed with the dictionary
+static std::string deflate_data(const std::string &data, DataCompression compression) {
+    if (compression == DataCompression::none) {
+        return std::string(1, (char)data_embed_uncompressed_tag) + data;
+    }
+    const bool preset_dictionary = compression == DataCompression::preset_dictionary;
+    z_stream zs{};
+    if (deflateInit2(&zs, preset_dictionary ? Z_BEST_COMPRESSION : Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                     preset_dictionary ? -MAX_WBITS : MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error{"failed to initialize deflate"};
+    }
+    const size_t offset = preset_dictionary ? 1 : 0;
+    std::string ret(offset + deflateBound(&zs, data.size()), 0x00);
+    if (preset_dictionary) {
+        ret[0] = (char)data_embed_preset_dictionary_tag;
+        deflateSetDictionary(&zs, reinterpret_cast<const Bytef*>(data_embed_preset_dictionary),
+                             sizeof(data_embed_preset_dictionary) - 1);
+    }
+
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+    zs.avail_in = (uInt)data.size();
+    zs.next_out = reinterpret_cast<Bytef*>(ret.data() + offset);
+    zs.avail_out = (uInt)(ret.size() - offset);
+    const int status = deflate(&zs, Z_FINISH);
+    ret.resize(offset + zs.total_out);
+    deflateEnd(&zs);
+    if (status != Z_STREAM_END) {
+        throw std::runtime_error{format("failed to compress the data: {}", zError(status))};
+    }
+    return ret;
 }
 
+// either kind of stream, told apart by the first byte; zlib detects gzip and zlib headers by itself
+static std::string inflate_data(const char *data, size_t size) {
+    if (size > 0 && (uint8_t)data[0] == data_embed_uncompressed_tag) {
+        return std::string(data + 1, size - 1);
+    }
+    const bool preset_dictionary = size > 0 && (uint8_t)data[0] == data_embed_preset_dictionary_tag;
+    const size_t offset = preset_dictionary ? 1 : 0;
+    z_stream zs{};
+    if (inflateInit2(&zs, preset_dictionary ? -MAX_WBITS : MAX_WBITS + 32) != Z_OK) {
+        throw std::runtime_error{"failed to initialize inflate"};
+    }
+    if (preset_dictionary) {
+        inflateSetDictionary(&zs, reinterpret_cast<const Bytef*>(data_embed_preset_dictionary),
+                             sizeof(data_embed_preset_dictionary) - 1);
+    }
+
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data + offset));
+    zs.avail_in = (uInt)(size - offset);
+    std::string ret(4 * size + 256, 0x00);
+    int status = Z_OK;
+    while (status == Z_OK) {
+        if (zs.total_out == ret.size()) {
+            ret.resize(2 * ret.size());
+        }
+        zs.next_out = reinterpret_cast<Bytef*>(ret.data() + zs.total_out);
+        zs.avail_out = (uInt)(ret.size() - zs.total_out);
+        status = inflate(&zs, Z_NO_FLUSH);
+    }
+    ret.resize(zs.total_out);
+    inflateEnd(&zs);
+    if (status != Z_STREAM_END) {
+        throw std::runtime_error{format("failed to decompress the data: {}", zError(status))};
+    }
+    return ret;
+}
+
+static std::string encode_timestamp_field(size_t timestamp) {
+    if (timestamp >> (8 * data_embed_timestamp_bytes) != 0) {
+        throw std::runtime_error{format("timestamp {} does not fit into the timestamp field", timestamp)};
+    }
+    std::string ret(data_embed_timestamp_field_size, 0x00);
+    ret[0] = (char)data_embed_timestamp_tag;
+    for(auto i = 0; i < data_embed_timestamp_bytes; ++i) {
+        ret[data_embed_timestamp_field_size - 1 - i] = (char)((timestamp >> (8 * i)) & 0xFF);
+    }
+    return ret;
+}
 
 DataEmbed::encoded_data_t DataEmbed::encode_data(const std::string &data) const {
-    std::stringstream zsstr;
-    // compress the data
-    zstr::ostream zos(zsstr);
-    zos << data;
-    zos.flush();
-    zsstr.flush();
-    auto compressed_data = zsstr.str();
+    auto compressed_data = deflate_data(data, _compression);
 
     std::string new_data = encode_metadata({(uint16_t)_num_rows,
                                                  (uint16_t)_num_blocks_per_row,
                                                  (uint16_t)compressed_data.size()}) + compressed_data;
+    return _encode_payload(new_data);
+}
 
+DataEmbed::encoded_data_t DataEmbed::_encode_payload(const std::string &new_data) const {
     // reed solomon code
-    std::array<char, rs_data_length> data_buf;
-    encoded_data_t rs_data;
-    rs_data.reserve((new_data.size() / rs_data_length + 1) * rs_code_length);
-
-    for(auto i = 0; i < new_data.size(); i += rs_data_length) {
-        int r = std::min(new_data.size(), i + rs_data_length);
-
-        std::copy(new_data.data() + i, new_data.data() + r, data_buf.data());
-
-        auto encoded_block = rs_encode_block(data_buf.data(), r - i);
-        // readout
-        std::copy(encoded_block.begin(), encoded_block.end(), std::back_inserter(rs_data));
-    }
+    encoded_data_t rs_data(rs_encoded_size(new_data.size()));
+    rs_encode_blocks(new_data.data(), new_data.size(), reinterpret_cast<int8_t*>(rs_data.data()));
 
     // expand the data
     auto expanded_data = expand_representation(rs_data, data_embed_expansion);
@@ -221,162 +215,205 @@ DataEmbed::encoded_data_t DataEmbed::encode_data(const std::string &data) const
     // copy the data
     std::copy(expanded_data.begin(), expanded_data.end(), ret.begin());
 
-    // expand the data
-
-
     return ret;
 }
 
 std::string DataEmbed::decode_data(const DataEmbed::encoded_data_t &enc_data) {
+    std::optional<size_t> timestamp;
+    return decode_data(enc_data, timestamp);
+}
 
-    std::vector<int8_t> decoded_data;
+std::string DataEmbed::decode_data(const DataEmbed::encoded_data_t &enc_data, std::optional<size_t> &timestamp) {
 
     // shrink data
     auto shrunk_data = shrink_representation(enc_data, data_embed_expansion);
+    if (shrunk_data.size() < rs_code_length) {
+        throw std::runtime_error{"end of encoded data reached before fully decoding the data"};
+    }
+    auto enc_blocks = reinterpret_cast<const int8_t*>(shrunk_data.data());
 
-    // decode metadata
-    auto metadata = rs_decode_metadata(shrunk_data);
+    // the first block holds the metadata and, unless the payload is a legacy one, the timestamp field
+    std::array<int8_t, rs_data_length> first_block;
+    rs_decode_blocks(enc_blocks, 1, first_block.data());
+    auto metadata = decode_metadata(first_block.data(), data_embed_metadata_size);
     int metadata_size = metadata.size() * sizeof(decltype(metadata)::value_type);
-    int original_data_len = metadata[2] + metadata_size;
-
-    // start decoding
-    std::array<char, rs_code_length> code_buf;
-    auto enc_ptr = 0;
-    while(decoded_data.size() < original_data_len) {
-        if(enc_ptr + rs_code_length > shrunk_data.size()) {
-            throw std::runtime_error{"end of encoded data reached before fully decoding the data"};
+    int header_size = metadata_size;
+    timestamp.reset();
+
+    // a legacy payload continues with the compressed data here
+    if ((uint8_t)first_block[metadata_size] == data_embed_timestamp_tag) {
+        size_t ts = 0;
+        for(auto i = 1; i <= data_embed_timestamp_bytes; ++i) {
+            ts = (ts << 8) | (uint8_t)first_block[metadata_size + i];
         }
+        timestamp = ts;
+        header_size += data_embed_timestamp_field_size;
+    }
 
-        std::copy(shrunk_data.data() + enc_ptr, shrunk_data.data() + enc_ptr + rs_code_length, code_buf.data());
-        auto decoded_buf = rs_decode_block(code_buf.data());
-        std::copy(decoded_buf.begin(), decoded_buf.end(), std::back_inserter(decoded_data));
-
-        enc_ptr += rs_code_length;
+    // decode the rest of the payload at once
+    const size_t num_blocks = (header_size + metadata[2] + rs_data_length - 1) / rs_data_length;
+    if (num_blocks * rs_code_length > shrunk_data.size()) {
+        throw std::runtime_error{"end of encoded data reached before fully decoding the data"};
     }
+    std::vector<int8_t> decoded_data(num_blocks * rs_data_length);
+    std::copy(first_block.begin(), first_block.end(), decoded_data.begin());
+    rs_decode_blocks(enc_blocks + rs_code_length, num_blocks - 1, decoded_data.data() + rs_data_length);
 
+    return inflate_data(reinterpret_cast<const char*>(decoded_data.data()) + header_size, metadata[2]);
+}
 
-    if (decoded_data.size() < original_data_len) {
-        throw std::runtime_error{"cannot correctly decode the data: decoded size mismatch"};
-    }
+cv::Mat DataEmbed::encoded_data_as_image(const cv::Mat &img, const std::string &data) const {
+    cv::Mat ret;
+    encoded_data_as_image(FrameView(img), data, ret, get_default_thread_pool());
+    return ret;
+}
 
-    auto decoded_compressed_data = std::string(decoded_data.begin() + metadata_size, decoded_data.begin() + original_data_len);
+cv::Mat DataEmbed::encoded_data_as_image(const FrameView &img, const std::string &data) const {
+    cv::Mat ret;
+    encoded_data_as_image(img, data, ret, get_default_thread_pool());
+    return ret;
+}
 
+void DataEmbed::encoded_data_as_image(const FrameView &img, const std::string &data, cv::Mat &out,
+                                      ThreadPool &pool) const {
+    // the frame copy (itself split over pool) and the payload encoding run as separate tasks
+    cv::Mat data_band;
+    encoded_data_t encoded_data_buffer;
+    pool.parallel_for(0, 2, [&](int task_begin, int task_end) {
+        for(auto task = task_begin; task < task_end; ++task) {
+            if (task == 0) {
+                data_band = _compose_frame(img, out, pool, _bottom_template, true);
+            } else {
+                encoded_data_buffer = encode_data(data);
+            }
+        }
+    });
 
-    std::stringstream zsstr;
-    zsstr << decoded_compressed_data;
-    zsstr.flush();
-    // compress the data
-    zstr::istream zis(zsstr);
+    _draw_markers(data_band);
+    _render_blocks(encoded_data_buffer.data(), 0, _num_bytes_total / 3, data_band);
+}
 
-    std::string ret(std::istreambuf_iterator<std::string::value_type>(zis), {});
+DataEmbed::DataBand DataEmbed::render_data_band(const std::string &data) const {
+    return render_data_band(data, _compression);
+}
 
+DataEmbed::DataBand DataEmbed::render_data_band(const std::string &data, DataCompression compression) const {
+    DataBand ret;
+    auto compressed_data = deflate_data(data, compression);
+    ret.header = encode_metadata({(uint16_t)_num_rows,
+                                  (uint16_t)_num_blocks_per_row,
+                                  (uint16_t)compressed_data.size()});
+    auto encoded_data_buffer = _encode_payload(ret.header + encode_timestamp_field(0) + compressed_data);
+
+    _bottom_template.copyTo(ret.image);
+    auto data_band = ret.image.rowRange(_block_size / 2, _block_size / 2 + _num_rows * _block_size);
+    _draw_markers(data_band);
+    _render_blocks(encoded_data_buffer.data(), 0, _num_bytes_total / 3, data_band);
     return ret;
 }
 
-cv::Mat DataEmbed::encoded_data_as_image(const cv::Mat &img, const std::string &data) const {
-    if(img.cols != _image_width) {
-        throw std::runtime_error{format("expected {} cols in the image, get {} instead", _image_width, img.cols)};
+void DataEmbed::encoded_data_as_image(const FrameView &img, const DataBand &band, size_t timestamp, cv::Mat &out,
+                                      ThreadPool &pool) const {
+    if (band.image.size() != _bottom_template.size()) {
+        throw std::runtime_error{"the data band was rendered for a different layout"};
     }
+    auto data_band = _compose_frame(img, out, pool, band.image, true);
+
+    // the first RS block holds the header and the timestamp field; its expanded bytes are whole pixel blocks
+    constexpr const int num_field_bytes = rs_code_length * data_embed_expansion;
+    static_assert(num_field_bytes % 3 == 0, "the timestamp block must cover whole pixel blocks");
+    auto field = band.header + encode_timestamp_field(timestamp);
+    auto encoded_block = rs_encode_block(field.data(), (int)field.size());
+    std::array<uint8_t, num_field_bytes> expanded_block;
+    expand_representation(reinterpret_cast<const uint8_t*>(encoded_block.data()), rs_code_length, data_embed_expansion,
+                          expanded_block.data());
+    _render_blocks(expanded_block.data(), 0, num_field_bytes / 3, data_band);
+}
 
-    auto encoded_data_buffer = encode_data(data);
-
-    cv::Mat ret(_num_rows * _block_size, _image_width_with_marker, CV_8UC3);
-    ret.setTo(cv::Vec3b(255,255,255));
-
+void DataEmbed::_draw_markers(cv::Mat &data_band) const {
+    // fiducial markers: bottom left and bottom right of the data band (the third one goes to the top right of the image)
+    _markers[0].copyTo(data_band(cv::Rect(_block_size/2, 0, _fiducial_marker_size, _fiducial_marker_size)));
+    _markers[1].copyTo(data_band(cv::Rect(_fiducial_marker_col_2, (_num_rows - 4) * _block_size, _fiducial_marker_size, _fiducial_marker_size)));
+}
 
-    // build markers
-    auto aruco_dict = cv::aruco::getPredefinedDictionary(cv_aruco_marker_dict);
-    cv::Mat marker;
-    cv::aruco::generateImageMarker(aruco_dict, cv_aruco_marker_inds[0], _fiducial_marker_size, marker);
-    cv::cvtColor(marker, marker, cv::COLOR_GRAY2BGR);
-    marker.copyTo(ret(cv::Rect(_block_size/2, 0, _fiducial_marker_size, _fiducial_marker_size)));
-    cv::aruco::generateImageMarker(aruco_dict, cv_aruco_marker_inds[1], _fiducial_marker_size, marker);
-    cv::cvtColor(marker, marker, cv::COLOR_GRAY2BGR);
-    marker.copyTo(ret(cv::Rect(_fiducial_marker_col_2, (_num_rows - 4) * _block_size, _fiducial_marker_size, _fiducial_marker_size)));
-
-
-//    cv::aruco::generateImageMarker(aruco_dict, cv_aruco_marker_inds[2], _fiducial_marker_size, marker);
-//    cv::cvtColor(marker, marker, cv::COLOR_GRAY2BGR);
-//    marker.copyTo(ret(cv::Rect(_image_width + _block_size/2, 0, _fiducial_marker_size, _fiducial_marker_size)));
-
-    for(auto i = 0; i < _num_rows; ++i) {
-        const auto j0 = i * _num_bytes_per_row;
-        const auto j1 = (i + 1) * _num_bytes_per_row;
-        for(auto j = j0; j < j1; j += 3) {
-            for(auto k = 0; k < _block_size; ++k) {
-                auto &pix = ret.at<cv::Vec3b>(i * _block_size, _block_size * (j - j0) / 3 + k + _fiducial_marker_size + _block_size);
-                pix[0] = encoded_data_buffer[j];
-                pix[1] = encoded_data_buffer[j+1];
-                pix[2] = encoded_data_buffer[j+2];
-            }
+void DataEmbed::_render_blocks(const uint8_t *data, int block_begin, int block_end, cv::Mat &data_band) const {
+    const int data_x = _fiducial_marker_size + _block_size;
+    const int c0 = data_embed_channel(_channel_order, 0), c2 = data_embed_channel(_channel_order, 2);
+    for(auto b = block_begin; b < block_end;) {
+        // the blocks of one band row: fill their top pixel row, then copy it to the other rows of the blocks
+        const int i = b / _num_blocks_per_row;
+        const int row_block_end = std::min(block_end, (i + 1) * _num_blocks_per_row);
+        auto top_row = data_band.ptr<cv::Vec3b>(i * _block_size) + data_x + (b % _num_blocks_per_row) * _block_size;
+        for(auto k = b; k < row_block_end; ++k) {
+            const uint8_t *pix = data + 3 * (k - block_begin);
+            cv::Vec3b color;
+            color[c0] = pix[0];
+            color[1] = pix[1];
+            color[c2] = pix[2];
+            std::fill_n(top_row + (k - b) * _block_size, _block_size, color);
         }
-    }
-
 
-    // copy the rows to form blocks
-    for(auto i = 0; i < _num_rows; ++i) {
-        auto data_region = ret(cv::Range(i * _block_size, i * _block_size + 1),
-                               cv::Range(_fiducial_marker_size + _block_size, _fiducial_marker_col_2 - _block_size / 2));
-        for(auto j = 1; j < _block_size; ++j) {
-            data_region.copyTo(ret(cv::Range(i * _block_size + j, i * _block_size + j +1),
-                                   cv::Range(_fiducial_marker_size + _block_size, _fiducial_marker_col_2 - _block_size / 2)));
+        const size_t row_bytes = (row_block_end - b) * _block_size * sizeof(cv::Vec3b);
+        for(auto r = 1; r < _block_size; ++r) {
+            std::memcpy(data_band.ptr<cv::Vec3b>(i * _block_size + r) + (top_row - data_band.ptr<cv::Vec3b>(i * _block_size)),
+                        top_row, row_bytes);
         }
+        b = row_block_end;
     }
-
-    // generate the right padder
-    cv::Mat padder_v(img.rows, _image_width_with_marker - _image_width, CV_8UC3);
-    padder_v.setTo(cv::Vec3b(255, 255, 255));
-
-    cv::aruco::generateImageMarker(aruco_dict, cv_aruco_marker_inds[2], _fiducial_marker_size, marker);
-    cv::cvtColor(marker, marker, cv::COLOR_GRAY2BGR);
-    marker.copyTo(padder_v(cv::Rect(_block_size/2, 0, _fiducial_marker_size, _fiducial_marker_size)));
-
-    cv::Mat img_vpad;
-    cv::hconcat(img, padder_v, img_vpad);
-
-    cv::Mat padder_h(_block_size / 2, _image_width_with_marker, CV_8UC3);
-    padder_h.setTo(cv::Vec3b(255, 255, 255));
-
-    // the top pad needs to be aligned with block size to avoid significant quality loss
-    cv::Mat padder_16(16, _image_width_with_marker, CV_8UC3);
-    padder_16.setTo(cv::Vec3b(255, 255, 255));
-
-    cv::vconcat(padder_16, img_vpad, img_vpad);
-    cv::vconcat(img_vpad, padder_h, img_vpad);
-    cv::vconcat(img_vpad, ret, ret);
-    cv::vconcat(ret, padder_h, ret);
-
-    return ret;
 }
 
 cv::Mat DataEmbed::encode_no_data(const cv::Mat &img) const {
-    if(img.cols != _image_width) {
-        throw std::runtime_error{format("expected {} cols in the image, get {} instead", _image_width, img.cols)};
-    }
+    cv::Mat ret;
+    encode_no_data(FrameView(img), ret, get_default_thread_pool());
+    return ret;
+}
 
-    cv::Mat ret(_num_rows * _block_size, _image_width_with_marker, CV_8UC3);
-    ret.setTo(cv::Vec3b(255,255,255));
+cv::Mat DataEmbed::encode_no_data(const FrameView &img) const {
+    cv::Mat ret;
+    encode_no_data(img, ret, get_default_thread_pool());
+    return ret;
+}
 
-    // generate the right padder
-    cv::Mat padder_v(img.rows, _image_width_with_marker - _image_width, CV_8UC3);
-    padder_v.setTo(cv::Vec3b(255, 255, 255));
+void DataEmbed::encode_no_data(const FrameView &img, cv::Mat &out, ThreadPool &pool) const {
+    _compose_frame(img, out, pool, _bottom_template, false);
+}
 
-    cv::Mat img_vpad;
-    cv::hconcat(img, padder_v, img_vpad);
+cv::Size DataEmbed::get_output_size(int image_rows) const {
+    return {_image_width_with_marker,
+            data_embed_top_pad_rows + image_rows + _block_size / 2 + _num_rows * _block_size + _block_size / 2};
+}
 
-    cv::Mat padder_h(_block_size / 2, _image_width_with_marker, CV_8UC3);
-    padder_h.setTo(cv::Vec3b(255, 255, 255));
+cv::Mat DataEmbed::_compose_frame(const FrameView &img, cv::Mat &out, ThreadPool &pool, const cv::Mat &bottom,
+                                  bool with_marker) const {
+    if(img.cols() != _image_width) {
+        throw std::runtime_error{format("expected {} cols in the image, get {} instead", _image_width, img.cols())};
+    }
+    if(with_marker && img.rows() < _fiducial_marker_size) {
+        throw std::runtime_error{format("expected at least {} rows in the image, get {} instead",
+                                        _fiducial_marker_size, img.rows())};
+    }
 
-    // the top pad needs to be aligned with block size to avoid significant quality loss
-    cv::Mat padder_16(16, _image_width_with_marker, CV_8UC3);
-    padder_16.setTo(cv::Vec3b(255, 255, 255));
+    // layout, top to bottom: top pad, image | right padder, half block pad, data band, half block pad
+    out.create(get_output_size(img.rows()), CV_8UC3);
+    const int image_y = data_embed_top_pad_rows;
+    const int bottom_y = image_y + img.rows();
+    const int band_y = bottom_y + _block_size / 2;
+
+    _top_template.copyTo(out.rowRange(0, image_y));
+    auto right_padder = out(cv::Rect(_image_width, image_y, _image_width_with_marker - _image_width, img.rows()));
+    int blank_y = 0;
+    if (with_marker) {
+        _marker_column_template.copyTo(right_padder.rowRange(0, _fiducial_marker_size));
+        blank_y = _fiducial_marker_size;
+    }
+    right_padder.rowRange(blank_y, right_padder.rows).setTo(cv::Vec3b(255, 255, 255));
+    bottom.copyTo(out.rowRange(bottom_y, out.rows));
 
-    cv::vconcat(padder_16, img_vpad, img_vpad);
-    cv::vconcat(img_vpad, padder_h, img_vpad);
-    cv::vconcat(img_vpad, ret, ret);
-    cv::vconcat(ret, padder_h, ret);
+    // the frame is read through the view straight into the output
+    cv::Mat img_region = out(cv::Rect(0, image_y, _image_width, img.rows()));
+    img.materialize(img_region, pool);
 
-    return ret;
+    return out.rowRange(band_y, band_y + _num_rows * _block_size);
 }
 
 size_t DataEmbed::get_data_region_width() const {
@@ -387,88 +424,187 @@ size_t DataEmbed::get_data_region_height() const {
     return _num_rows * _block_size;
 }
 
+DataCompression DataEmbed::get_compression() const {
+    return _compression;
+}
 
-DataEmbed::encoded_data_t expand_representation(const DataEmbed::encoded_data_t &enc_data, int expansion) {
-    if(expansion < 1 || expansion >= 8 || 8 % expansion != 0) {
-        throw std::runtime_error{"invalid expansion value"};
-    }
-    int num_bits_per_part = 8 / expansion;
-    int num_values_per_part = (1 << num_bits_per_part);
-    float image_value_step_size = 256.0f / num_values_per_part;
+void DataEmbed::set_compression(DataCompression compression) {
+    _compression = compression;
+}
 
-    std::vector<uint8_t> part_value_lut(num_values_per_part, 0);
-    for(auto i = 0; i < part_value_lut.size(); ++i) {
-        part_value_lut[i] = lround((i  + 0.5f) * image_value_step_size);
-    }
+ChannelOrder DataEmbed::get_channel_order() const {
+    return _channel_order;
+}
 
+void DataEmbed::set_channel_order(ChannelOrder order) {
+    _channel_order = order;
+}
 
-    uint8_t base_extractor = num_values_per_part - 1;
-    std::vector<uint8_t> part_extractors(expansion, 0);
-    for(auto i = 0; i < part_extractors.size(); ++i) {
-        part_extractors[i] = base_extractor << (i * num_bits_per_part);
-    }
 
-    DataEmbed::encoded_data_t ret;
-    ret.reserve(enc_data.size() * expansion);
+// Every byte is split into expansion parts of 8 / expansion bits (lowest bits first) and each part is written as the
+// center of its value range. Both directions are fixed functions of a byte, so they are tabulated at compile time.
+struct RepresentationLut {
+    int num_bits_per_part;
+    // the expansion values of every byte
+    std::array<std::array<uint8_t, 8>, 256> expanded;
+    // the part whose value is closest to a byte (the lower one on ties)
+    std::array<uint8_t, 256> part;
+    // bytes >= part_thresholds[k] belong to part k + 1 or above
+    std::array<uint8_t, 256> part_thresholds;
+};
 
-    for(auto i = 0; i < enc_data.size(); ++i) {
-        for(auto j = 0; j < part_extractors.size(); ++j) {
-            uint8_t part = (enc_data[i] &  part_extractors[j]) >> (j * num_bits_per_part);
-            ret.push_back(part_value_lut[part]);
-        }
-    }
+static constexpr RepresentationLut make_representation_lut(int expansion) {
+    RepresentationLut lut{};
+    lut.num_bits_per_part = 8 / expansion;
+    const int num_values_per_part = 1 << lut.num_bits_per_part;
 
-    return ret;
-}
+    // lround((i + 0.5) * 256 / num_values_per_part), truncated to a byte
+    std::array<uint8_t, 256> part_value{};
+    for(auto i = 0; i < num_values_per_part; ++i) {
+        part_value[i] = (uint8_t)(((2 * i + 1) * 256 / num_values_per_part + 1) / 2);
+    }
 
-DataEmbed::encoded_data_t shrink_representation(const DataEmbed::encoded_data_t &enc_data, int expansion) {
-    if(expansion < 1 || expansion >= 8 || 8 % expansion != 0) {
-        throw std::runtime_error{"invalid expansion value"};
+    for(auto v = 0; v < 256; ++v) {
+        for(auto j = 0; j < expansion; ++j) {
+            lut.expanded[v][j] = part_value[(v >> (j * lut.num_bits_per_part)) & (num_values_per_part - 1)];
+        }
+        int best = 0;
+        for(auto i = 1; i < num_values_per_part; ++i) {
+            const int d = part_value[i] > v ? part_value[i] - v : v - part_value[i];
+            const int best_d = part_value[best] > v ? part_value[best] - v : v - part_value[best];
+            if (d < best_d) {
+                best = i;
+            }
+        }
+        lut.part[v] = (uint8_t)best;
     }
-    if(enc_data.size() % expansion != 0) {
-        throw std::runtime_error{"the expanded representation to be decoded has invalid size"};
+    for(auto k = 0; k + 1 < num_values_per_part; ++k) {
+        lut.part_thresholds[k] = 255;
+        for(auto v = 255; v >= 0 && lut.part[v] > k; --v) {
+            lut.part_thresholds[k] = (uint8_t)v;
+        }
     }
+    return lut;
+}
 
-    int num_bits_per_part = 8 / expansion;
-    int num_values_per_part = (1 << num_bits_per_part);
-    float image_value_step_size = 256.0f / num_values_per_part;
+static constexpr std::array<RepresentationLut, 3> representation_luts{
+    make_representation_lut(1), make_representation_lut(2), make_representation_lut(4)};
 
-    std::vector<uint8_t> part_value_lut(num_values_per_part, 0);
-    for(auto i = 0; i < part_value_lut.size(); ++i) {
-        part_value_lut[i] = lround((i  + 0.5f) * image_value_step_size);
+static const RepresentationLut &get_representation_lut(int expansion) {
+    switch(expansion) {
+        case 1: return representation_luts[0];
+        case 2: return representation_luts[1];
+        case 4: return representation_luts[2];
+        default: throw std::runtime_error{"invalid expansion value"};
     }
+}
 
-
-    uint8_t base_extractor = num_values_per_part - 1;
-    std::vector<uint8_t> part_extractors(expansion, 0);
-    for(auto i = 0; i < part_extractors.size(); ++i) {
-        part_extractors[i] = base_extractor << (i * num_bits_per_part);
+#if defined(LIBVIDSCRAMBLE_SSE41)
+// 2 bit parts: 16 bytes -> 64 values. Every byte is broadcast to its 4 lanes; lanes 0 and 1 look their part up in
+// the low nibble, lanes 2 and 3 in the high nibble, even lanes take the low 2 bits of the nibble and odd lanes the
+// high 2 bits.
+static size_t expand_representation_4(const uint8_t *data, size_t size, uint8_t *out) {
+    const auto &lut = representation_luts[2];
+    alignas(16) uint8_t low_part[16], high_part[16];
+    for(auto n = 0; n < 16; ++n) {
+        low_part[n] = lut.expanded[n][0];
+        high_part[n] = lut.expanded[n][1];
     }
+    const __m128i low_part_table = _mm_load_si128(reinterpret_cast<const __m128i*>(low_part));
+    const __m128i high_part_table = _mm_load_si128(reinterpret_cast<const __m128i*>(high_part));
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i high_nibble_lanes = _mm_set1_epi32((int)0xFFFF0000);
+    const __m128i odd_lanes = _mm_set1_epi16((short)0xFF00);
+
+    size_t i = 0;
+    for(; i + 16 <= size; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        for(auto k = 0; k < 4; ++k) {
+            const char b = (char)(4 * k);
+            const __m128i x = _mm_shuffle_epi8(v, _mm_setr_epi8(b, b, b, b, b + 1, b + 1, b + 1, b + 1,
+                                                                b + 2, b + 2, b + 2, b + 2, b + 3, b + 3, b + 3, b + 3));
+            const __m128i n = _mm_blendv_epi8(_mm_and_si128(x, nibble),
+                                              _mm_and_si128(_mm_srli_epi16(x, 4), nibble), high_nibble_lanes);
+            const __m128i values = _mm_blendv_epi8(_mm_shuffle_epi8(low_part_table, n),
+                                                   _mm_shuffle_epi8(high_part_table, n), odd_lanes);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4 * i + 16 * k), values);
+        }
+    }
+    return i;
+}
 
-    DataEmbed::encoded_data_t data_closest;
-    data_closest.reserve(enc_data.size());
-    std::vector<int16_t> dist(num_values_per_part, 0);
-
-    for(auto i = 0; i < enc_data.size(); ++i) {
-        // find its original representation
-        for(auto j = 0; j < num_values_per_part; ++j) {
-            dist[j] = abs((int16_t)part_value_lut[j] - (int16_t)enc_data[i]);
+// 2 bit parts: 64 values -> 16 bytes. Parts are counted against the 3 thresholds and combined by multiply-adds.
+static size_t shrink_representation_4(const uint8_t *data, size_t size, uint8_t *out) {
+    const auto &lut = representation_luts[2];
+    const __m128i thresholds[3] = {_mm_set1_epi8((char)lut.part_thresholds[0]),
+                                   _mm_set1_epi8((char)lut.part_thresholds[1]),
+                                   _mm_set1_epi8((char)lut.part_thresholds[2])};
+    const __m128i pair_weights = _mm_set1_epi16(1 | (4 << 8));
+    const __m128i quad_weights = _mm_set1_epi32(1 | (16 << 16));
+
+    size_t i = 0;
+    for(; i + 64 <= size; i += 64) {
+        __m128i bytes[4];
+        for(auto k = 0; k < 4; ++k) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + 16 * k));
+            // every passed threshold subtracts -1
+            __m128i parts = _mm_setzero_si128();
+            for(const auto &t : thresholds) {
+                parts = _mm_sub_epi8(parts, _mm_cmpeq_epi8(_mm_max_epu8(v, t), v));
+            }
+            bytes[k] = _mm_madd_epi16(_mm_maddubs_epi16(parts, pair_weights), quad_weights);
         }
-        auto min_ele = std::min_element(dist.begin(), dist.end());
-        auto min_ele_ind = std::distance(dist.begin(), min_ele);
-        data_closest.push_back(min_ele_ind);
+        const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(bytes[0], bytes[1]), _mm_packs_epi32(bytes[2], bytes[3]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i / 4), packed);
+    }
+    return i;
+}
+#endif
+
+void expand_representation(const uint8_t *data, size_t size, int expansion, uint8_t *out) {
+    const auto &lut = get_representation_lut(expansion);
+    size_t i = 0;
+#if defined(LIBVIDSCRAMBLE_SSE41)
+    if (expansion == 4) {
+        i = expand_representation_4(data, size, out);
     }
+#endif
+    for(; i < size; ++i) {
+        std::memcpy(out + i * expansion, lut.expanded[data[i]].data(), expansion);
+    }
+}
 
-    DataEmbed::encoded_data_t ret;
-    ret.reserve(enc_data.size()/expansion);
-    for(auto i = 0; i < data_closest.size(); i += expansion) {
+void shrink_representation(const uint8_t *data, size_t size, int expansion, uint8_t *out) {
+    const auto &lut = get_representation_lut(expansion);
+    if(size % expansion != 0) {
+        throw std::runtime_error{"the expanded representation to be decoded has invalid size"};
+    }
+    size_t i = 0;
+#if defined(LIBVIDSCRAMBLE_SSE41)
+    if (expansion == 4) {
+        i = shrink_representation_4(data, size, out);
+    }
+#endif
+    for(; i < size; i += expansion) {
         uint8_t val = 0;
         for(auto j = 0; j < expansion; ++j) {
-            uint8_t part_val = data_closest[i+j] << (j * num_bits_per_part);
-            val = val | part_val;
+            val |= lut.part[data[i + j]] << (j * lut.num_bits_per_part);
         }
-        ret.push_back(val);
+        out[i / expansion] = val;
     }
+}
 
+DataEmbed::encoded_data_t expand_representation(const DataEmbed::encoded_data_t &enc_data, int expansion) {
+    // throws on invalid expansions before anything is allocated
+    get_representation_lut(expansion);
+    DataEmbed::encoded_data_t ret(enc_data.size() * expansion);
+    expand_representation(enc_data.data(), enc_data.size(), expansion, ret.data());
+    return ret;
+}
+
+DataEmbed::encoded_data_t shrink_representation(const DataEmbed::encoded_data_t &enc_data, int expansion) {
+    get_representation_lut(expansion);
+    DataEmbed::encoded_data_t ret(enc_data.size() / expansion);
+    shrink_representation(enc_data.data(), enc_data.size(), expansion, ret.data());
     return ret;
 }
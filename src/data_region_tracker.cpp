@@ -0,0 +1,155 @@
+#include "data_region_tracker.h"
+
+
+// cells of the bottom left marker that may be misread (compression artifacts) before it counts as gone
+constexpr const int max_marker_cell_errors = 6;
+constexpr const int marker_cells_per_side = 8;
+
+DataRegionTracker::DataRegionTracker(const FiducialDetector &detector) : _detector(&detector) {
+    // one pixel per cell
+    cv::Mat marker;
+    cv::aruco::generateImageMarker(cv::aruco::getPredefinedDictionary(cv_aruco_marker_dict), cv_aruco_marker_inds[0],
+                                   marker_cells_per_side, marker);
+    for(auto i = 0; i < marker_cells_per_side; ++i) {
+        for(auto j = 0; j < marker_cells_per_side; ++j) {
+            _marker_cells[i * marker_cells_per_side + j] = marker.at<uint8_t>(i, j) > 127;
+        }
+    }
+}
+
+DataRegionTracker::Status DataRegionTracker::update(const cv::Mat &img) {
+    if (img.type() != CV_8UC3) {
+        throw std::runtime_error{"only supports 3 channel ubyte image"};
+    }
+    ++_stats.num_frames;
+
+    // a new resolution invalidates the transform without looking at the frame
+    if (_has_transform && img.size() == _frame_size) {
+        switch(_verify(img)) {
+            case Verification::match:
+                ++_stats.num_verified;
+                return Status::tracked;
+            case Verification::no_data:
+                ++_stats.num_no_data;
+                return Status::tracked;
+            case Verification::mismatch:
+                break;
+        }
+    }
+
+    ++_stats.num_detections;
+    _has_transform = VideoScramblePipeline::get_data_extraction_transform(img, _transform, *_detector,
+                                                                          _channel_order);
+    if (!_has_transform) {
+        ++_stats.num_failed_detections;
+        return Status::lost;
+    }
+    _frame_size = img.size();
+    return Status::detected;
+}
+
+const ImageDataTransform &DataRegionTracker::get_transform() const {
+    if (!_has_transform) {
+        throw std::runtime_error{"the tracker has no transform"};
+    }
+    return _transform;
+}
+
+bool DataRegionTracker::has_transform() const {
+    return _has_transform;
+}
+
+void DataRegionTracker::reset() {
+    _has_transform = false;
+}
+
+ChannelOrder DataRegionTracker::get_channel_order() const {
+    return _channel_order;
+}
+
+void DataRegionTracker::set_channel_order(ChannelOrder order) {
+    if (order != _channel_order) {
+        _channel_order = order;
+        reset();
+    }
+}
+
+const DataRegionTracker::Stats &DataRegionTracker::get_stats() const {
+    return _stats;
+}
+
+DataRegionTracker::Verification DataRegionTracker::_verify(const cv::Mat &img) const {
+    bool blank = false;
+    if (!_verify_marker(img, blank)) {
+        return blank ? Verification::no_data : Verification::mismatch;
+    }
+    return _verify_header(img) ? Verification::match : Verification::mismatch;
+}
+
+bool DataRegionTracker::_verify_marker(const cv::Mat &img, bool &blank) const {
+    // the marker (four blocks wide) sits half a block right of the image region edge and half a block left of the
+    // data region, on the first four data rows
+    const auto &tf = _transform;
+    const float block_size_x = (tf.data_region_x - tf.image_region_x) / 5;
+    const float block_size_y = tf.data_region_height / tf.num_data_rows;
+    const float x_begin = tf.image_region_x + block_size_x / 2;
+    const float x_end = tf.data_region_x - block_size_x / 2;
+    const float cell_w = (x_end - x_begin) / marker_cells_per_side;
+    const float cell_h = 4 * block_size_y / marker_cells_per_side;
+
+    int num_errors = 0, num_white = 0;
+    for(auto i = 0; i < marker_cells_per_side; ++i) {
+        const long y = lround(tf.data_region_y + (i + 0.5f) * cell_h);
+        for(auto j = 0; j < marker_cells_per_side; ++j) {
+            const long x = lround(x_begin + (j + 0.5f) * cell_w);
+            if (x < 0 || y < 0 || x >= img.cols || y >= img.rows) {
+                return false;
+            }
+            const auto &pix = img.at<cv::Vec3b>((int)y, (int)x);
+            const bool white = pix[0] + pix[1] + pix[2] > 3 * 127;
+            num_white += white;
+            num_errors += white != _marker_cells[i * marker_cells_per_side + j];
+        }
+    }
+    blank = num_white > marker_cells_per_side * marker_cells_per_side - max_marker_cell_errors;
+    return num_errors <= max_marker_cell_errors;
+}
+
+bool DataRegionTracker::_verify_header(const cv::Mat &img) const {
+    // the first RS block of the payload, sampled like VideoScramblePipeline::extract_data does
+    constexpr const size_t num_code_bytes = rs_code_length * data_embed_expansion;
+    static_assert(num_code_bytes % 3 == 0, "the first RS block must cover whole pixel blocks");
+    const auto &tf = _transform;
+    if (tf.num_data_cols * 3 < (int)num_code_bytes) {
+        return false;
+    }
+    const float block_size_x = tf.data_region_width / tf.num_data_cols;
+    const float block_size_y = tf.data_region_height / tf.num_data_rows;
+    const long y = lround(tf.data_region_y + block_size_y / 2);
+
+    std::array<uint8_t, num_code_bytes> code;
+    const int c0 = data_embed_channel(tf.channel_order, 0), c2 = data_embed_channel(tf.channel_order, 2);
+    for(size_t j = 0; j < num_code_bytes / 3; ++j) {
+        const long x = lround(tf.data_region_x + block_size_x / 2 + j * block_size_x);
+        if (x < 0 || y < 0 || x >= img.cols || y >= img.rows) {
+            return false;
+        }
+        const auto &pix = img.at<cv::Vec3b>((int)y, (int)x);
+        code[3 * j] = pix[c0];
+        code[3 * j + 1] = pix[1];
+        code[3 * j + 2] = pix[c2];
+    }
+
+    std::array<uint8_t, rs_code_length> shrunk;
+    std::array<int8_t, rs_data_length> header;
+    try {
+        shrink_representation(code.data(), code.size(), data_embed_expansion, shrunk.data());
+        rs_decode_blocks(reinterpret_cast<const int8_t*>(shrunk.data()), 1, header.data());
+    } catch (const std::exception &) {
+        return false;
+    }
+    // big endian number of rows and blocks per row
+    const int num_rows = ((uint8_t)header[0] << 8) | (uint8_t)header[1];
+    const int num_cols = ((uint8_t)header[2] << 8) | (uint8_t)header[3];
+    return num_rows == tf.num_data_rows && num_cols == tf.num_data_cols;
+}
@@ -0,0 +1,124 @@
+#include "fiducial_detector.h"
+#include "data_embed.h"
+#include <algorithm>
+
+
+FiducialDetector::FiducialDetector(const cv::aruco::DetectorParameters &params)
+        : _detector(cv::aruco::getPredefinedDictionary(cv_aruco_marker_dict), params) {
+
+}
+
+const cv::aruco::DetectorParameters &FiducialDetector::get_detector_parameters() const {
+    return _detector.getDetectorParameters();
+}
+
+void FiducialDetector::set_detector_parameters(const cv::aruco::DetectorParameters &params) {
+    _detector.setDetectorParameters(params);
+}
+
+void FiducialDetector::detect(const cv::Mat &img, std::vector<std::vector<cv::Point2f>> &marker_corners,
+                              std::vector<int> &marker_inds) const {
+    _detector.detectMarkers(img, marker_corners, marker_inds);
+}
+
+// the search corners span this fraction of the frame width and height
+constexpr const float data_marker_search_fraction = 1.0f / 3;
+// frames are downscaled by an integer factor to at most about this width for the coarse search
+constexpr const int data_marker_search_width = 1920;
+
+// the markers are gray, so the channel order does not matter
+static void to_gray(const cv::Mat &img, cv::Mat &out) {
+    if (img.channels() == 3) {
+        cv::cvtColor(img, out, cv::COLOR_BGR2GRAY);
+    } else {
+        out = img;
+    }
+}
+
+bool FiducialDetector::_detect_in_corners(const cv::Mat &img, std::vector<std::vector<cv::Point2f>> &marker_corners,
+                                          std::vector<int> &marker_inds) const {
+    const int scale = std::max(1, img.cols / data_marker_search_width);
+    // multiples of the scale, so the downscaled corners map back exactly
+    const int search_w = (int)std::ceil(img.cols * data_marker_search_fraction / scale) * scale;
+    const int search_h = (int)std::ceil(img.rows * data_marker_search_fraction / scale) * scale;
+    if (search_w > img.cols || search_h > img.rows) {
+        return false;
+    }
+    // bottom left and bottom right: the data band; top right: the padding column
+    const std::array<cv::Rect, 3> search_rects{
+            cv::Rect(0, img.rows - search_h, search_w, search_h),
+            cv::Rect(img.cols - search_w, img.rows - search_h, search_w, search_h),
+            cv::Rect(img.cols - search_w, 0, search_w, search_h)};
+
+    // full resolution windows around the candidates, by marker
+    std::array<cv::Rect, cv_aruco_marker_inds.size()> windows;
+    std::array<bool, cv_aruco_marker_inds.size()> found{};
+    cv::Mat gray, small;
+    std::vector<std::vector<cv::Point2f>> candidate_corners;
+    std::vector<int> candidate_inds;
+    for(const auto &search_rect : search_rects) {
+        to_gray(img(search_rect), gray);
+        if (scale > 1) {
+            cv::resize(gray, small, cv::Size(search_w / scale, search_h / scale), 0, 0, cv::INTER_AREA);
+        } else {
+            small = gray;
+        }
+        _detector.detectMarkers(small, candidate_corners, candidate_inds);
+        for(size_t c = 0; c < candidate_inds.size(); ++c) {
+            auto it = std::find(cv_aruco_marker_inds.begin(), cv_aruco_marker_inds.end(), candidate_inds[c]);
+            if (it == cv_aruco_marker_inds.end()) {
+                continue;
+            }
+            const auto k = std::distance(cv_aruco_marker_inds.begin(), it);
+            // a marker seen twice is left to the whole frame search
+            if (found[k]) {
+                return false;
+            }
+            found[k] = true;
+
+            // back to full resolution, with a margin of half the marker size
+            std::vector<cv::Point2f> full_corners;
+            for(const auto &p : candidate_corners[c]) {
+                full_corners.emplace_back(p.x * scale + search_rect.x, p.y * scale + search_rect.y);
+            }
+            const cv::Rect box = cv::boundingRect(full_corners);
+            const int margin = std::max(box.width, box.height) / 2 + 2 * scale;
+            windows[k] = cv::Rect(box.x - margin, box.y - margin, box.width + 2 * margin, box.height + 2 * margin)
+                    & cv::Rect(0, 0, img.cols, img.rows);
+        }
+    }
+    if (std::find(found.begin(), found.end(), false) != found.end()) {
+        return false;
+    }
+
+    marker_corners.clear();
+    marker_inds.clear();
+    for(size_t k = 0; k < cv_aruco_marker_inds.size(); ++k) {
+        to_gray(img(windows[k]), gray);
+        _detector.detectMarkers(gray, candidate_corners, candidate_inds);
+        auto it = std::find(candidate_inds.begin(), candidate_inds.end(), cv_aruco_marker_inds[k]);
+        if (it == candidate_inds.end()) {
+            return false;
+        }
+        auto &corners = candidate_corners[std::distance(candidate_inds.begin(), it)];
+        for(auto &p : corners) {
+            p.x += (float)windows[k].x;
+            p.y += (float)windows[k].y;
+        }
+        marker_corners.emplace_back(std::move(corners));
+        marker_inds.push_back(cv_aruco_marker_inds[k]);
+    }
+    return true;
+}
+
+void FiducialDetector::detect_data_markers(const cv::Mat &img, std::vector<std::vector<cv::Point2f>> &marker_corners,
+                                           std::vector<int> &marker_inds) const {
+    if (!_detect_in_corners(img, marker_corners, marker_inds)) {
+        detect(img, marker_corners, marker_inds);
+    }
+}
+
+FiducialDetector &get_default_fiducial_detector() {
+    static FiducialDetector detector;
+    return detector;
+}
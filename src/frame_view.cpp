@@ -0,0 +1,121 @@
+#include "frame_view.h"
+#include "scrambler_kernels.h"
+
+
+FrameView::FrameView(const cv::Mat &base) : _base(base) {
+
+}
+
+cv::Size FrameView::size() const {
+    return _transposed ? cv::Size(_base.rows, _base.cols) : _base.size();
+}
+
+int FrameView::rows() const {
+    return size().height;
+}
+
+int FrameView::cols() const {
+    return size().width;
+}
+
+int FrameView::type() const {
+    return _base.type();
+}
+
+const cv::Mat &FrameView::base() const {
+    return _base;
+}
+
+bool FrameView::is_transposed() const {
+    return _transposed;
+}
+
+cv::Point FrameView::offset() const {
+    return _offset;
+}
+
+bool FrameView::is_plain() const {
+    return !_transposed && _offset == cv::Point(0, 0);
+}
+
+FrameView FrameView::shifted(const cv::Point &shift) const {
+    FrameView ret(*this);
+    ret._offset.x = (_offset.x + shift.x) % cols();
+    ret._offset.y = (_offset.y + shift.y) % rows();
+    return ret;
+}
+
+FrameView FrameView::transposed() const {
+    // this(x, y) reads oriented base pixel ((x + offset.y), (y + offset.x)), so the offset components swap
+    FrameView ret(*this);
+    ret._transposed = !_transposed;
+    ret._offset = cv::Point(_offset.y, _offset.x);
+    return ret;
+}
+
+// splits [begin, begin + length) of a wrapped axis into at most two ranges that are contiguous in the base image;
+// each piece is (position in the view, position in the oriented base, length)
+static int split_wrapped_range(int begin, int length, int offset, int size, cv::Vec3i pieces[2]) {
+    const int wrapped_begin = (begin + offset) % size;
+    const int first_length = std::min(length, size - wrapped_begin);
+    pieces[0] = cv::Vec3i(begin, wrapped_begin, first_length);
+    if (first_length == length) {
+        return 1;
+    }
+    pieces[1] = cv::Vec3i(begin + first_length, 0, length - first_length);
+    return 2;
+}
+
+void FrameView::read(const cv::Rect &rect, cv::Mat &out, ThreadPool &pool) const {
+    CV_Assert(rect.x >= 0 && rect.y >= 0 && rect.x + rect.width <= cols() && rect.y + rect.height <= rows());
+    CV_Assert(out.empty() || out.data != _base.data);
+
+    out.create(rect.height, rect.width, _base.type());
+
+    cv::Vec3i row_pieces[2], col_pieces[2];
+    const int num_row_pieces = split_wrapped_range(rect.y, rect.height, _offset.y, rows(), row_pieces);
+    const int num_col_pieces = split_wrapped_range(rect.x, rect.width, _offset.x, cols(), col_pieces);
+
+    for(auto i = 0; i < num_row_pieces; ++i) {
+        for(auto j = 0; j < num_col_pieces; ++j) {
+            const auto &r = row_pieces[i];
+            const auto &c = col_pieces[j];
+            cv::Mat dst = out(cv::Rect(c[0] - rect.x, r[0] - rect.y, c[2], r[2]));
+            if (!_transposed) {
+                _base(cv::Rect(c[1], r[1], c[2], r[2])).copyTo(dst);
+            } else {
+                transpose_into(_base(cv::Rect(r[1], c[1], r[2], c[2])), dst, pool);
+            }
+        }
+    }
+}
+
+void FrameView::materialize(cv::Mat &out, ThreadPool &pool) const {
+    out.create(rows(), cols(), _base.type());
+
+    // bands of transpose_tile_size rows keep the transposed reads cache blocked
+    auto read_bands = [&](int band_begin, int band_end) {
+        for(auto band = band_begin; band < band_end; ++band) {
+            const int y = band * transpose_tile_size;
+            const int num_rows = std::min(transpose_tile_size, rows() - y);
+            cv::Mat dst = out.rowRange(y, y + num_rows);
+            read(cv::Rect(0, y, cols(), num_rows), dst, pool);
+        }
+    };
+
+    const int num_bands = (rows() + transpose_tile_size - 1) / transpose_tile_size;
+    if (out.total() * out.elemSize() >= kernel_parallel_min_bytes) {
+        pool.parallel_for(0, num_bands, read_bands);
+    } else {
+        read_bands(0, num_bands);
+    }
+}
+
+cv::Mat FrameView::to_mat(ThreadPool &pool) const {
+    if (is_plain()) {
+        return _base;
+    }
+    cv::Mat ret;
+    materialize(ret, pool);
+    return ret;
+}
@@ -0,0 +1,220 @@
+#include "gather_map.h"
+#include "scrambler_kernels.h"
+#include <cstring>
+#include <limits>
+
+
+bool GatherMap::supports_size(const cv::Size &size) {
+    constexpr const int max_dim = std::numeric_limits<uint16_t>::max();
+    return size.width > 0 && size.height > 0 && size.width <= max_dim && size.height <= max_dim;
+}
+
+GatherMap GatherMap::compile(const ScramblerState &state,
+                             const std::vector<std::shared_ptr<ScramblerBase>> &steps,
+                             const cv::Size &input_size,
+                             bool inverse) {
+    if (!supports_size(input_size)) {
+        throw std::runtime_error{format("cannot build a gather map for an image of size {}x{}",
+                                        input_size.width, input_size.height)};
+    }
+
+    // identity map: every pixel holds its own coordinate
+    cv::Mat cur_map(input_size, CV_16UC2);
+    for(auto y = 0; y < cur_map.rows; ++y) {
+        auto row = cur_map.ptr<cv::Vec2w>(y);
+        for(auto x = 0; x < cur_map.cols; ++x) {
+            row[x] = cv::Vec2w((uint16_t)x, (uint16_t)y);
+        }
+    }
+
+    // the steps only move pixels around, so the coordinates end up where the pixels would
+    auto push_step = [&](const std::shared_ptr<ScramblerBase> &step) {
+        if (!is_static_permutation(step->type())) {
+            throw std::runtime_error{"only static permutation steps can be compiled into a gather map"};
+        }
+        cur_map = inverse ? step->inverse_transform(state, cur_map) : step->transform(state, cur_map);
+        if (!supports_size(cur_map.size())) {
+            throw std::runtime_error{format("cannot build a gather map for an image of size {}x{}",
+                                            cur_map.cols, cur_map.rows)};
+        }
+    };
+
+    if (!inverse) {
+        for(const auto &step : steps) {
+            push_step(step);
+        }
+    } else {
+        for(auto iter = steps.rbegin(); iter != steps.rend(); ++iter) {
+            push_step(*iter);
+        }
+    }
+
+    GatherMap ret;
+    ret._map = cur_map;
+    ret._input_size = input_size;
+    return ret;
+}
+
+// output rows [y_begin, y_end)
+template<typename PixT>
+static void gather_impl(const cv::Mat &map, const cv::Mat &img, cv::Mat &out,
+                        const cv::Point &src_offset, const cv::Point &dst_offset, int y_begin, int y_end) {
+    const int out_h = map.rows, out_w = map.cols;
+    const int in_h = img.rows, in_w = img.cols;
+    const uchar *src = img.data;
+    const size_t src_step = img.step[0];
+
+    for(auto tile_y = y_begin; tile_y < y_end; tile_y += gather_tile_size) {
+        const int tile_y_end = std::min(y_end, tile_y + gather_tile_size);
+        for(auto tile_x = 0; tile_x < out_w; tile_x += gather_tile_size) {
+            const int tile_x_end = std::min(out_w, tile_x + gather_tile_size);
+
+            for(auto y = tile_y; y < tile_y_end; ++y) {
+                int map_y = y + dst_offset.y;
+                if (map_y >= out_h) {
+                    map_y -= out_h;
+                }
+                const auto map_row = map.ptr<cv::Vec2w>(map_y);
+                auto out_row = out.ptr<PixT>(y);
+
+                int x = tile_x;
+                while(x < tile_x_end) {
+                    int map_x = x + dst_offset.x;
+                    if (map_x >= out_w) {
+                        map_x -= out_w;
+                    }
+                    // columns until the map wraps around
+                    const int segment_end = std::min(tile_x_end, x + (out_w - map_x));
+                    for(; x < segment_end; ++x, ++map_x) {
+                        int src_x = map_row[map_x][0] + src_offset.x;
+                        int src_y = map_row[map_x][1] + src_offset.y;
+                        if (src_x >= in_w) {
+                            src_x -= in_w;
+                        }
+                        if (src_y >= in_h) {
+                            src_y -= in_h;
+                        }
+                        out_row[x] = reinterpret_cast<const PixT*>(src + src_y * src_step)[src_x];
+                    }
+                }
+            }
+        }
+    }
+}
+
+void GatherMap::apply(const cv::Mat &img, cv::Mat &out, const cv::Point &src_offset, const cv::Point &dst_offset,
+                      ThreadPool &pool) const {
+    if (empty()) {
+        throw std::runtime_error{"the gather map has not been compiled"};
+    }
+    if (img.size() != _input_size) {
+        throw std::runtime_error{format("expected an image of size {}x{}, get {}x{}",
+                                        _input_size.width, _input_size.height, img.cols, img.rows)};
+    }
+
+    // the gather cannot run in place
+    if (out.data == img.data) {
+        out = cv::Mat();
+    }
+    out.create(_map.rows, _map.cols, img.type());
+
+    auto gather_bands = [&](int band_begin, int band_end) {
+        const int y_begin = band_begin * gather_tile_size;
+        const int y_end = std::min(_map.rows, band_end * gather_tile_size);
+        switch (img.elemSize()) {
+            case 1:
+                gather_impl<uchar>(_map, img, out, src_offset, dst_offset, y_begin, y_end);
+                break;
+            case 3:
+                gather_impl<cv::Vec3b>(_map, img, out, src_offset, dst_offset, y_begin, y_end);
+                break;
+            case 4:
+                gather_impl<uint32_t>(_map, img, out, src_offset, dst_offset, y_begin, y_end);
+                break;
+            default: {
+                // pixel sizes without a dedicated instantiation
+                const size_t elem_size = img.elemSize();
+                for(auto y = y_begin; y < y_end; ++y) {
+                    int map_y = (y + dst_offset.y) % _map.rows;
+                    const auto map_row = _map.ptr<cv::Vec2w>(map_y);
+                    auto out_row = out.ptr(y);
+                    for(auto x = 0; x < _map.cols; ++x) {
+                        const auto &m = map_row[(x + dst_offset.x) % _map.cols];
+                        auto src_x = (m[0] + src_offset.x) % img.cols;
+                        auto src_y = (m[1] + src_offset.y) % img.rows;
+                        std::memcpy(out_row + x * elem_size, img.ptr(src_y) + src_x * elem_size, elem_size);
+                    }
+                }
+                break;
+            }
+        }
+    };
+
+    const int num_bands = (_map.rows + gather_tile_size - 1) / gather_tile_size;
+    if (out.total() * out.elemSize() >= kernel_parallel_min_bytes) {
+        pool.parallel_for(0, num_bands, gather_bands);
+    } else {
+        gather_bands(0, num_bands);
+    }
+}
+
+cv::Size GatherMap::input_size() const {
+    return _input_size;
+}
+
+cv::Size GatherMap::output_size() const {
+    return _map.size();
+}
+
+bool GatherMap::empty() const {
+    return _map.empty();
+}
+
+
+FusedPermutation::FusedPermutation(const ScramblerState &state,
+                                   std::shared_ptr<const ImageShift> lead_shift,
+                                   const std::vector<std::shared_ptr<ScramblerBase>> &steps,
+                                   std::shared_ptr<const ImageShift> trail_shift,
+                                   const cv::Size &input_size) : _lead_shift(std::move(lead_shift)),
+                                                                 _trail_shift(std::move(trail_shift)) {
+    _forward = GatherMap::compile(state, steps, input_size, false);
+    _inverse = GatherMap::compile(state, steps, _forward.output_size(), true);
+}
+
+// the wrap offset of a non-transposed view folds into the source offset of the gather
+static cv::Mat gather_source(const FrameView &img, cv::Point &src_offset, ThreadPool &pool) {
+    if (img.is_transposed()) {
+        return img.to_mat(pool);
+    }
+    const auto &base = img.base();
+    src_offset = normalize_wrap_offset(src_offset.x + img.offset().x, src_offset.y + img.offset().y,
+                                       base.cols, base.rows);
+    return base;
+}
+
+void FusedPermutation::transform(const ScramblerState &state, const FrameView &img, cv::Mat &out,
+                                 ThreadPool &pool) const {
+    cv::Point src_offset(0, 0), dst_offset(0, 0);
+    if (_lead_shift) {
+        src_offset = _lead_shift->get_offset(state, img.size(), false);
+    }
+    if (_trail_shift) {
+        dst_offset = _trail_shift->get_offset(state, _forward.output_size(), false);
+    }
+    auto src = gather_source(img, src_offset, pool);
+    _forward.apply(src, out, src_offset, dst_offset, pool);
+}
+
+void FusedPermutation::inverse_transform(const ScramblerState &state, const FrameView &img, cv::Mat &out,
+                                         ThreadPool &pool) const {
+    // the shifts swap roles: the trailing shift is undone first, while reading the input
+    cv::Point src_offset(0, 0), dst_offset(0, 0);
+    if (_trail_shift) {
+        src_offset = _trail_shift->get_offset(state, img.size(), true);
+    }
+    if (_lead_shift) {
+        dst_offset = _lead_shift->get_offset(state, _inverse.output_size(), true);
+    }
+    auto src = gather_source(img, src_offset, pool);
+    _inverse.apply(src, out, src_offset, dst_offset, pool);
+}
@@ -1,6 +1,15 @@
 #include "pipeline.h"
+#include "scrambler_kernels.h"
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
+
+#if defined(LIBVIDSCRAMBLE_STATS)
+#define PIPELINE_STATS(...) __VA_ARGS__
+#else
+#define PIPELINE_STATS(...)
+#endif
 
 VideoScramblePipeline::VideoScramblePipeline(std::shared_ptr<std::vector<pipeline_step_t>> steps,
                                              int data_embed_block_size,
@@ -34,73 +43,384 @@ void VideoScramblePipeline::fit(const cv::Mat &img) {
     _state.input_width = img.cols;
 
     cv::Mat cur_img(img);
+    std::vector<cv::Size> step_input_sizes;
     for(const pipeline_step_t &step : *_steps){
+        step_input_sizes.push_back(cur_img.size());
         step->fit(_state, cur_img);
         cur_img = step->transform(_state, cur_img);
     }
+    step_input_sizes.push_back(cur_img.size());
+
+    _build_stages(step_input_sizes);
 
     _state.timestamp = 0;
     _state.output_width_wo_data = cur_img.cols;
     _state.output_height_wo_data = cur_img.rows;
 
     _data_embed = std::make_unique<DataEmbed>(_data_embed_block_size, _data_embed_num_rows, _state.output_width_wo_data);
+    _data_embed->set_compression(_data_compression);
+    _data_embed->set_channel_order(_channel_order);
 
     _state.data_region_height = _data_embed->get_data_region_height();
     _state.data_region_width = _data_embed->get_data_region_width();
 
+    _allocate_scratch(_scratch);
+
+    // stats slots: the forward stages, the data embedding, the region extraction, the inverse stages, the final copy
+    PIPELINE_STATS(
+        std::vector<PipelineStatsRecorder::Stage> stats_stages;
+        for(const auto &stage : _stages) {
+            stats_stages.push_back({stage.name, false});
+        }
+        stats_stages.push_back({"DataEmbed", false});
+        stats_stages.push_back({"extract_image_region", true});
+        for(const auto &stage : _stages) {
+            stats_stages.push_back({stage.name, true});
+        }
+        stats_stages.push_back({"output", true});
+        _stats = std::make_shared<PipelineStatsRecorder>(std::move(stats_stages));
+    )
+
     _fit = true;
+    _update_data_band();
 }
 
 cv::Mat VideoScramblePipeline::transform(const cv::Mat &img) {
-    if (img.type() != CV_8UC3) {
-        throw std::runtime_error{"only supports 3 channel ubyte image"};
-    }
+    cv::Mat ret;
+    transform_into(img, ret);
+    return ret;
+}
 
-    _assert_fit();
-    cv::Mat cur_img(img);
+cv::Mat VideoScramblePipeline::inverse_transform(const cv::Mat &img, const ImageDataTransform &info) {
+    cv::Mat ret;
+    inverse_transform_into(img, info, ret);
+    return ret;
+}
 
-    for(const pipeline_step_t &step : *_steps){
-        cur_img = step->transform(_state, cur_img);
+#if defined(LIBVIDSCRAMBLE_STATS)
+static size_t frame_view_bytes(const FrameView &view) {
+    return (size_t)view.rows() * view.cols() * view.base().elemSize();
+}
+
+// Times one stage of a frame and counts what it copied: a stage whose output is (a view of) its input moved no pixels,
+// and a buffer whose data pointer changed was reallocated.
+class StageTimer {
+public:
+    StageTimer(PipelineStatsRecorder::ThreadCounters &counters, size_t slot, const FrameView &input,
+               const cv::Mat &buffer) : _counters(counters),
+                                        _slot(slot),
+                                        _input_data(input.base().datastart),
+                                        _input_bytes(frame_view_bytes(input)),
+                                        _buffer_data(buffer.data),
+                                        _begin(std::chrono::steady_clock::now()) {}
+
+    void stop(const FrameView &output, const cv::Mat &buffer) {
+        const bool copied = output.base().datastart != _input_data;
+        _counters.record(_slot, std::chrono::steady_clock::now() - _begin, copied ? _input_bytes : 0,
+                         copied ? frame_view_bytes(output) : 0, buffer.data != _buffer_data);
     }
 
-    cv::Mat ret;
-    if(_state.timestamp % _data_embed_interval == 0) {
-        ret = to_json_image(cur_img);
-    } else {
-        ret = to_no_data_image(cur_img);
+private:
+    PipelineStatsRecorder::ThreadCounters &_counters;
+    size_t _slot;
+    const uchar *_input_data;
+    size_t _input_bytes;
+    const uchar *_buffer_data;
+    std::chrono::steady_clock::time_point _begin;
+};
+#endif
+
+// fused stages gather from a plain or shifted frame; a transposed view is materialized into the stage's buffer first
+static FrameView fused_stage_input(const FrameView &img, cv::Mat &input_buffer, ThreadPool &pool) {
+    if (!img.is_transposed()) {
+        return img;
+    }
+    img.materialize(input_buffer, pool);
+    return FrameView(input_buffer);
+}
+
+void VideoScramblePipeline::transform_into(const cv::Mat &img, cv::Mat &out) {
+    _transform_frame(img, _state.timestamp, _scratch, out);
+
+    if(_transform_increment_timestamp){
+        increment_timestamp();
     }
+}
+
+void VideoScramblePipeline::inverse_transform_into(const cv::Mat &img, const ImageDataTransform &info, cv::Mat &out) {
+    _inverse_transform_frame(img, info, _state.timestamp, _scratch, out);
 
     if(_transform_increment_timestamp){
         increment_timestamp();
     }
+}
+
+PipelineScratchPool::Lease PipelineScratchPool::acquire() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_free.empty()) {
+        _sets.emplace_back(std::make_unique<PipelineScratch>());
+        _free.reserve(_sets.size());
+        return Lease(*this, _sets.back().get());
+    }
+    auto scratch = _free.back();
+    _free.pop_back();
+    return Lease(*this, scratch);
+}
+
+void PipelineScratchPool::_release(PipelineScratch *scratch) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _free.push_back(scratch);
+}
 
+cv::Mat VideoScramblePipeline::transform(const cv::Mat &img, size_t timestamp) const {
+    cv::Mat ret;
+    transform_into(img, timestamp, ret);
     return ret;
 }
 
-cv::Mat VideoScramblePipeline::inverse_transform(const cv::Mat &img, const ImageDataTransform &info) {
+cv::Mat VideoScramblePipeline::inverse_transform(const cv::Mat &img, const ImageDataTransform &info,
+                                                 size_t timestamp) const {
+    cv::Mat ret;
+    inverse_transform_into(img, info, timestamp, ret);
+    return ret;
+}
+
+void VideoScramblePipeline::transform_into(const cv::Mat &img, size_t timestamp, cv::Mat &out) const {
     _assert_fit();
+    auto scratch = _scratch_pool.acquire();
+    // buffers are only reallocated when the set last ran before fit() changed the frame sizes
+    _allocate_scratch(scratch.get());
+    _transform_frame(img, timestamp, scratch.get(), out);
+}
+
+void VideoScramblePipeline::inverse_transform_into(const cv::Mat &img, const ImageDataTransform &info,
+                                                   size_t timestamp, cv::Mat &out) const {
+    _assert_fit();
+    auto scratch = _scratch_pool.acquire();
+    _allocate_scratch(scratch.get());
+    _inverse_transform_frame(img, info, timestamp, scratch.get(), out);
+}
 
+std::vector<cv::Mat> VideoScramblePipeline::transform_batch(const std::vector<cv::Mat> &frames,
+                                                            size_t start_timestamp) const {
+    std::vector<cv::Mat> ret;
+    transform_batch_into(frames, start_timestamp, ret);
+    return ret;
+}
+
+std::vector<cv::Mat> VideoScramblePipeline::inverse_transform_batch(const std::vector<cv::Mat> &frames,
+                                                                    const ImageDataTransform &info,
+                                                                    size_t start_timestamp) const {
+    std::vector<cv::Mat> ret;
+    inverse_transform_batch_into(frames, info, start_timestamp, ret);
+    return ret;
+}
+
+void VideoScramblePipeline::transform_batch_into(const std::vector<cv::Mat> &frames, size_t start_timestamp,
+                                                 std::vector<cv::Mat> &out) const {
+    _assert_fit();
+
+    out.resize(frames.size());
+    _get_thread_pool().parallel_for(0, (int)frames.size(), [&](int frame_begin, int frame_end) {
+        for(auto i = frame_begin; i < frame_end; ++i) {
+            transform_into(frames[i], start_timestamp + i, out[i]);
+        }
+    });
+}
+
+void VideoScramblePipeline::inverse_transform_batch_into(const std::vector<cv::Mat> &frames,
+                                                         const ImageDataTransform &info, size_t start_timestamp,
+                                                         std::vector<cv::Mat> &out) const {
+    _assert_fit();
+
+    out.resize(frames.size());
+    _get_thread_pool().parallel_for(0, (int)frames.size(), [&](int frame_begin, int frame_end) {
+        for(auto i = frame_begin; i < frame_end; ++i) {
+            inverse_transform_into(frames[i], info, start_timestamp + i, out[i]);
+        }
+    });
+}
+
+cv::Size VideoScramblePipeline::get_input_size() const {
+    _assert_fit();
+    return {(int)_state.input_width, (int)_state.input_height};
+}
+
+cv::Size VideoScramblePipeline::get_output_size() const {
+    _assert_fit();
+    return _data_embed->get_output_size((int)_state.output_height_wo_data);
+}
+
+void VideoScramblePipeline::_transform_frame(const cv::Mat &img, size_t timestamp, PipelineScratch &scratch,
+                                             cv::Mat &out) const {
     if (img.type() != CV_8UC3) {
         throw std::runtime_error{"only supports 3 channel ubyte image"};
     }
 
-    cv::Mat cur_img(img);
+    _assert_fit();
+    _assert_no_alias(img, out);
+
+    ScramblerState state = _state;
+    state.timestamp = timestamp;
+    auto &pool = _get_thread_pool();
+
+    // transposes and shifts stay lazy until the next step (or the data embedding) copies the pixels
+    FrameView cur_img(img);
+    PIPELINE_STATS(auto &stats = _stats->local();)
+
+    for(size_t i = 0; i < _stages.size(); ++i){
+        const auto &stage = _stages[i];
+        auto &buffer = scratch.forward_buffers[i];
+        PIPELINE_STATS(StageTimer timer(stats, i, cur_img, buffer);)
+        if (stage.fused) {
+            stage.fused->transform(state, fused_stage_input(cur_img, scratch.input_buffers[i], pool), buffer, pool);
+            cur_img = FrameView(buffer);
+        } else {
+            cur_img = stage.step->transform_view(state, cur_img, buffer, pool);
+        }
+        PIPELINE_STATS(timer.stop(cur_img, buffer);)
+    }
 
-    // extract image region
-    cur_img = extract_image_region(img, info);
+    PIPELINE_STATS(StageTimer embed_timer(stats, _stages.size(), cur_img, out);)
+    if(timestamp % _data_embed_interval == 0) {
+        _data_embed->encoded_data_as_image(cur_img, _data_band, timestamp, out, pool);
+    } else {
+        _data_embed->encode_no_data(cur_img, out, pool);
+    }
+    PIPELINE_STATS(embed_timer.stop(FrameView(out), out);)
+}
+
+void VideoScramblePipeline::_inverse_transform_frame(const cv::Mat &img, const ImageDataTransform &info,
+                                                     size_t timestamp, PipelineScratch &scratch, cv::Mat &out) const {
+    _assert_fit();
 
-    for(auto iter = _steps->rbegin(); iter != _steps->rend(); ++iter){
-        cur_img = (*iter)->inverse_transform(_state, cur_img);
+    if (img.type() != CV_8UC3) {
+        throw std::runtime_error{"only supports 3 channel ubyte image"};
+    }
+    _assert_no_alias(img, out);
+
+    ScramblerState state = _state;
+    state.timestamp = timestamp;
+    auto &pool = _get_thread_pool();
+
+    PIPELINE_STATS(
+        auto &stats = _stats->local();
+        const size_t inverse_slot = _stages.size() + 2;
+        StageTimer region_timer(stats, _stages.size() + 1, FrameView(img), scratch.inverse_input);
+    )
+
+    // extract image region, read in place or resampled in one pass
+    const cv::Rect region((int)lround(info.image_region_x), (int)lround(info.image_region_y),
+                          (int)lround(info.image_region_width), (int)lround(info.image_region_height));
+    FrameView cur_img(scratch.region_sampler.sample(
+            img, region, cv::Size(info.original_image_region_width, info.original_image_region_height),
+            scratch.inverse_input, pool));
+    PIPELINE_STATS(region_timer.stop(cur_img, scratch.inverse_input);)
+
+    for(auto i = (int)_stages.size() - 1; i >= 0; --i){
+        const auto &stage = _stages[i];
+        // the last stage that copies pixels writes the result directly
+        auto &buffer = i == 0 ? out : scratch.inverse_buffers[i];
+        PIPELINE_STATS(StageTimer timer(stats, inverse_slot + i, cur_img, buffer);)
+        if (stage.fused) {
+            stage.fused->inverse_transform(state, fused_stage_input(cur_img, scratch.input_buffers[i], pool), buffer,
+                                           pool);
+            cur_img = FrameView(buffer);
+        } else {
+            cur_img = stage.step->inverse_transform_view(state, cur_img, buffer, pool);
+        }
+        PIPELINE_STATS(timer.stop(cur_img, buffer);)
     }
 
-    if(_transform_increment_timestamp){
-        increment_timestamp();
+    // a trailing view (or an empty pipeline) still has to be copied out
+    if (!cur_img.is_plain() || cur_img.base().data != out.data) {
+        PIPELINE_STATS(StageTimer output_timer(stats, inverse_slot + _stages.size(), cur_img, out);)
+        cur_img.materialize(out, pool);
+        PIPELINE_STATS(output_timer.stop(FrameView(out), out);)
+    }
+}
+
+void VideoScramblePipeline::_allocate_scratch(PipelineScratch &scratch) const {
+    scratch.forward_buffers.resize(_stages.size());
+    scratch.inverse_buffers.resize(_stages.size());
+    scratch.input_buffers.resize(_stages.size());
+    for(size_t i = 0; i < _stages.size(); ++i) {
+        const auto &stage = _stages[i];
+        if (stage.fused || !is_view_only(stage.step->type())) {
+            scratch.forward_buffers[i].create(stage.output_size, CV_8UC3);
+            scratch.inverse_buffers[i].create(stage.input_size, CV_8UC3);
+        }
     }
+    scratch.inverse_input.create((int)_state.output_height_wo_data, (int)_state.output_width_wo_data, CV_8UC3);
+}
 
-    return cur_img;
+void VideoScramblePipeline::_assert_no_alias(const cv::Mat &img, const cv::Mat &out) const {
+    if (!out.empty() && out.data == img.data) {
+        throw std::runtime_error{"[VideoScramblePipeline] the output must not share data with the input image"};
+    }
 }
 
 
+void VideoScramblePipeline::_build_stages(const std::vector<cv::Size> &step_input_sizes) {
+    _stages.clear();
+
+    const auto &steps = *_steps;
+    size_t i = 0;
+    while(i < steps.size()) {
+        if (_permutation_fusion) {
+            // a fusable run: [ImageShift] static permutation steps... [ImageShift]
+            auto run_end = i;
+            std::shared_ptr<const ImageShift> lead_shift, trail_shift;
+            if (steps[run_end]->type() == ScramblerType::ImageShift) {
+                lead_shift = std::static_pointer_cast<const ImageShift>(steps[run_end]);
+                ++run_end;
+            }
+
+            std::vector<pipeline_step_t> run_steps;
+            while(run_end < steps.size() && is_static_permutation(steps[run_end]->type())) {
+                run_steps.push_back(steps[run_end]);
+                ++run_end;
+            }
+
+            if (!run_steps.empty() && run_end < steps.size() && steps[run_end]->type() == ScramblerType::ImageShift) {
+                trail_shift = std::static_pointer_cast<const ImageShift>(steps[run_end]);
+                ++run_end;
+            }
+
+            // a single step gains nothing from the gather, and neither does a run that only transposes and
+            // shifts, since those stay lazy views
+            bool fusable = run_end - i >= 2 && std::any_of(run_steps.begin(), run_steps.end(), [](const pipeline_step_t &step) {
+                return !is_view_only(step->type());
+            });
+            for(auto j = i; fusable && j <= run_end; ++j) {
+                fusable = GatherMap::supports_size(step_input_sizes[j]);
+            }
+
+            if (fusable) {
+                PipelineStage stage;
+                for(auto j = i; j < run_end; ++j) {
+                    stage.name += (j == i ? "" : "+") + steps[j]->to_json()["name"].get<std::string>();
+                }
+                stage.fused = std::make_shared<FusedPermutation>(_state, lead_shift, run_steps, trail_shift,
+                                                                 step_input_sizes[i]);
+                stage.input_size = step_input_sizes[i];
+                stage.output_size = step_input_sizes[run_end];
+                _stages.push_back(stage);
+                i = run_end;
+                continue;
+            }
+        }
+
+        PipelineStage stage;
+        stage.step = steps[i];
+        stage.name = steps[i]->to_json()["name"].get<std::string>();
+        stage.input_size = step_input_sizes[i];
+        stage.output_size = step_input_sizes[i + 1];
+        _stages.push_back(stage);
+        ++i;
+    }
+}
+
 void VideoScramblePipeline::_assert_fit() const {
     if(!_fit){
         throw std::runtime_error{format("[VideoScramblePipeline] the fit() function must be called before use")};
@@ -108,6 +428,12 @@ void VideoScramblePipeline::_assert_fit() const {
 }
 
 std::string VideoScramblePipeline::to_json() const {
+    auto ret = _to_json_object();
+    ret["state"]["timestamp"] = _state.timestamp;
+    return ret.dump();
+}
+
+nlohmann::ordered_json VideoScramblePipeline::_to_json_object() const {
     _assert_fit();
     nlohmann::ordered_json ret;
     std::vector<nlohmann::json> steps;
@@ -132,12 +458,29 @@ std::string VideoScramblePipeline::to_json() const {
     state["data_region_height"] = _state.data_region_height;
     state["input_height"] = _state.input_height;
     state["input_width"] = _state.input_width;
-    state["timestamp"] = _state.timestamp;
 
 
     ret["state"] = state;
 
-    return ret.dump();
+    return ret;
+}
+
+PipelineMetadata VideoScramblePipeline::_to_metadata() const {
+    PipelineMetadata ret;
+    pipeline_metadata_from_json(_to_json_object(), ret);
+    ret.state.timestamp = _state.timestamp;
+    return ret;
+}
+
+void VideoScramblePipeline::_update_data_band() {
+    // the timestamp travels in the fixed field of the band, everything else only changes with the configuration
+    const bool binary = _metadata_format == MetadataFormat::binary;
+    auto payload = binary ? encode_pipeline_metadata(_to_metadata()) : _to_json_object().dump();
+    if (payload == _data_band_payload && !_data_band.image.empty()) {
+        return;
+    }
+    _data_band = _data_embed->render_data_band(payload, binary ? DataCompression::none : _data_compression);
+    _data_band_payload = std::move(payload);
 }
 
 cv::Mat VideoScramblePipeline::to_json_image(const cv::Mat &img) const {
@@ -157,19 +500,24 @@ cv::Mat VideoScramblePipeline::to_no_data_image(const cv::Mat &img) const {
 
 
 bool VideoScramblePipeline::get_data_extraction_transform(const cv::Mat &img, ImageDataTransform &info) {
+    return get_data_extraction_transform(img, info, get_default_fiducial_detector());
+}
+
+bool VideoScramblePipeline::get_data_extraction_transform(const cv::Mat &img, ImageDataTransform &info,
+                                                          const FiducialDetector &detector) {
+    return get_data_extraction_transform(img, info, detector, ChannelOrder::rgb);
+}
+
+bool VideoScramblePipeline::get_data_extraction_transform(const cv::Mat &img, ImageDataTransform &info,
+                                                          const FiducialDetector &detector,
+                                                          ChannelOrder channel_order) {
     if (img.type() != CV_8UC3) {
         throw std::runtime_error{"only supports 3 channel ubyte image"};
     }
 
-    auto aruco_dict = cv::aruco::getPredefinedDictionary(cv_aruco_marker_dict);
-    cv::Mat marker;
-    cv::aruco::generateImageMarker(aruco_dict, cv_aruco_marker_inds[0], 32, marker);
-
     std::vector<int> marker_inds;
     std::vector<std::vector<cv::Point2f>> marker_corners;
-    cv::aruco::DetectorParameters detector_params = cv::aruco::DetectorParameters();
-    cv::aruco::ArucoDetector detector(aruco_dict, detector_params);
-    detector.detectMarkers(img, marker_corners, marker_inds);
+    detector.detect_data_markers(img, marker_corners, marker_inds);
 
     // try to find markers
     auto marker_0_find = std::find(marker_inds.begin(), marker_inds.end(), cv_aruco_marker_inds[0]);
@@ -185,7 +533,7 @@ bool VideoScramblePipeline::get_data_extraction_transform(const cv::Mat &img, Im
     }
 
     auto marker_2_find = std::find(marker_inds.begin(), marker_inds.end(), cv_aruco_marker_inds[2]);
-    if (marker_1_find == marker_inds.end()) {
+    if (marker_2_find == marker_inds.end()) {
         std::cerr << "unable to find the top right fiducial marker\n";
         return false;
     }
@@ -262,6 +610,9 @@ bool VideoScramblePipeline::get_data_extraction_transform(const cv::Mat &img, Im
     auto num_metadata_rs_code = (6 / rs_data_length) + (6 % rs_data_length != 0); // metadata field has length 6
     auto num_metadata_rs_block = num_metadata_rs_code * (rs_code_length / 3) * data_embed_expansion;
     std::vector<uint8_t> code_buf(num_metadata_rs_block * 3, 0x00);
+    std::vector<uint8_t> shrunk_code_buf(code_buf.size() / data_embed_expansion, 0x00);
+    PipelineMetadata metadata_buf;
+    const int c0 = data_embed_channel(channel_order, 0), c2 = data_embed_channel(channel_order, 2);
 
     bool decode_success = false;
     // the estimate of block_size_x is unreliable
@@ -284,16 +635,15 @@ bool VideoScramblePipeline::get_data_extraction_transform(const cv::Mat &img, Im
                 for(auto j = 0; j < num_metadata_rs_block; ++j) {
                     float pix_x = dr_x_0 + j * block_size_x_changed;
                     const cv::Vec3b &pix_val = img.at<cv::Vec3b>(lround(dr_y_0), lround(pix_x));
-                    code_buf[3 * j] = pix_val[0];
+                    code_buf[3 * j] = pix_val[c0];
                     code_buf[3 * j + 1] = pix_val[1];
-                    code_buf[3 * j + 2] = pix_val[2];
+                    code_buf[3 * j + 2] = pix_val[c2];
                 }
             }
 
             // try decoding this block
-            std::vector<uint8_t> shrunk_code_buf;
             try{
-                shrunk_code_buf = shrink_representation(code_buf, data_embed_expansion);
+                shrink_representation(code_buf.data(), code_buf.size(), data_embed_expansion, shrunk_code_buf.data());
             } catch (const std::exception &e) {
                 std::cerr << format("[delta={}] unable to shrink binary representation: {}\n", block_size_x_change_factor, e.what());
                 continue;
@@ -341,26 +691,19 @@ bool VideoScramblePipeline::get_data_extraction_transform(const cv::Mat &img, Im
             info.image_region_y = y_min_2;
             info.image_region_width = x_min_2 - block_size_x/2 - info.image_region_x;
             info.image_region_height = y_min_1 - block_size_y / 2 - info.image_region_y;
+            info.channel_order = channel_order;
 
-            std::string decoded_data;
             try {
-                decoded_data = extract_data(img, info);
+                extract_metadata(img, info, metadata_buf);
             } catch (const std::exception &e) {
                 std::cerr << format("[delta={}] an error occurred trying to parse data: {}\n", block_size_x_change_factor, e.what());
                 continue;
             }
 
-            nlohmann::json parsed_data;
-            try {
-                parsed_data = nlohmann::json::parse(decoded_data);
-                info.original_image_region_width = parsed_data["state"]["output_width_wo_data"].get<int>();
-                info.original_image_region_height = parsed_data["state"]["output_height_wo_data"].get<int>();
-                info.original_data_region_width = parsed_data["state"]["data_region_width"].get<int>();
-                info.original_data_region_height = parsed_data["state"]["data_region_height"].get<int>();
-            } catch (const std::exception &e) {
-                std::cerr << format("[delta={}] an error occurred trying to parse data as JSON: {}\n", block_size_x_change_factor, e.what());
-                continue;
-            }
+            info.original_image_region_width = (int)metadata_buf.state.output_width_wo_data;
+            info.original_image_region_height = (int)metadata_buf.state.output_height_wo_data;
+            info.original_data_region_width = (int)metadata_buf.state.data_region_width;
+            info.original_data_region_height = (int)metadata_buf.state.data_region_height;
 
 
 
@@ -377,17 +720,16 @@ bool VideoScramblePipeline::get_data_extraction_transform(const cv::Mat &img, Im
     return true;
 }
 
-std::string VideoScramblePipeline::extract_data(const cv::Mat &img, const ImageDataTransform &info) {
+std::string VideoScramblePipeline::_extract_payload(const cv::Mat &img, const ImageDataTransform &info,
+                                                    std::optional<size_t> &timestamp) {
 
     float block_size_x = info.data_region_width / info.num_data_cols;
     float block_size_y = info.data_region_height / info.num_data_rows;
     float start_x = info.data_region_x + block_size_x / 2;
     float start_y = info.data_region_y + block_size_y / 2;
 
-    cv::Mat new_img;
-    img.copyTo(new_img);
-
     DataEmbed::encoded_data_t encoded_data(3 * info.num_data_cols * info.num_data_rows, 0x00);
+    const int c0 = data_embed_channel(info.channel_order, 0), c2 = data_embed_channel(info.channel_order, 2);
 
     for(auto i = 0; i < info.num_data_rows; ++i) {
         float y = start_y + i * block_size_y;
@@ -395,18 +737,58 @@ std::string VideoScramblePipeline::extract_data(const cv::Mat &img, const ImageD
         for(auto j = 0; j < info.num_data_cols; ++j) {
             float x = start_x + j * block_size_x;
             const auto &pix = img.at<cv::Vec3b>(lround(y), lround(x));
-            encoded_data[3 * (row_offset + j)] = pix[0];
+            encoded_data[3 * (row_offset + j)] = pix[c0];
             encoded_data[3 * (row_offset + j) + 1] = pix[1];
-            encoded_data[3 * (row_offset + j) + 2] = pix[2];
+            encoded_data[3 * (row_offset + j) + 2] = pix[c2];
         }
     }
 
 
-    return DataEmbed::decode_data(encoded_data);
+    return DataEmbed::decode_data(encoded_data, timestamp);
+}
+
+std::string VideoScramblePipeline::extract_data(const cv::Mat &img, const ImageDataTransform &info) {
+    std::optional<size_t> timestamp;
+    auto ret = _extract_payload(img, info, timestamp);
+
+    nlohmann::ordered_json json_data;
+    if (is_binary_pipeline_metadata(ret.data(), ret.size())) {
+        PipelineMetadata metadata;
+        if (!decode_pipeline_metadata(ret.data(), ret.size(), metadata)) {
+            throw std::runtime_error{"the embedded binary metadata is corrupted"};
+        }
+        json_data = pipeline_metadata_to_json(metadata);
+    } else if (timestamp) {
+        json_data = nlohmann::ordered_json::parse(ret);
+    } else {
+        return ret;
+    }
+    // the timestamp field goes back into the state, where to_json() puts it
+    if (timestamp) {
+        json_data["state"]["timestamp"] = *timestamp;
+    }
+    return json_data.dump();
+}
+
+void VideoScramblePipeline::extract_metadata(const cv::Mat &img, const ImageDataTransform &info,
+                                             PipelineMetadata &metadata) {
+    std::optional<size_t> timestamp;
+    auto payload = _extract_payload(img, info, timestamp);
+    if (is_binary_pipeline_metadata(payload.data(), payload.size())) {
+        if (!decode_pipeline_metadata(payload.data(), payload.size(), metadata)) {
+            throw std::runtime_error{"the embedded binary metadata is corrupted"};
+        }
+        metadata.state.timestamp = 0;
+    } else {
+        pipeline_metadata_from_json(nlohmann::ordered_json::parse(payload), metadata);
+    }
+    if (timestamp) {
+        metadata.state.timestamp = *timestamp;
+    }
 }
 
 
-cv::Mat get_padded_roi(const cv::Mat &input, int top_left_x, int top_left_y, int width, int height) {
+cv::Mat get_padded_roi(const cv::Mat &input, int top_left_x, int top_left_y, int width, int height, cv::Mat &padded_buffer) {
     int bottom_right_x = top_left_x + width;
     int bottom_right_y = top_left_y + height;
 
@@ -435,7 +817,8 @@ cv::Mat get_padded_roi(const cv::Mat &input, int top_left_x, int top_left_y, int
         }
 
         cv::Rect R(top_left_x, top_left_y, width, height);
-        copyMakeBorder(input(R), output, border_top, border_bottom, border_left, border_right, cv::BORDER_REFLECT);
+        copyMakeBorder(input(R), padded_buffer, border_top, border_bottom, border_left, border_right, cv::BORDER_REFLECT);
+        output = padded_buffer;
     }
     else {
         // no border padding required
@@ -445,15 +828,91 @@ cv::Mat get_padded_roi(const cv::Mat &input, int top_left_x, int top_left_y, int
     return output;
 }
 
+cv::Mat ImageRegionSampler::sample(const cv::Mat &img, const cv::Rect &region, const cv::Size &out_size,
+                                   cv::Mat &buffer, ThreadPool &pool) {
+    if (region.width <= 0 || region.height <= 0 || out_size.width <= 0 || out_size.height <= 0) {
+        throw std::runtime_error{format("invalid image region {}x{} at ({}, {}) for an output of {}x{}", region.width,
+                                        region.height, region.x, region.y, out_size.width, out_size.height)};
+    }
+    if (region.size() == out_size && (region & cv::Rect(0, 0, img.cols, img.rows)) == region) {
+        return img(region);
+    }
+    if (_map_xy.empty() || region != _region || img.size() != _frame_size || out_size != _out_size) {
+        _build_maps(region, img.size(), out_size);
+    }
+
+    buffer.create(out_size, img.type());
+    auto remap_rows = [&](int row_begin, int row_end) {
+        cv::Mat out_rows = buffer.rowRange(row_begin, row_end);
+        cv::remap(img, out_rows, _map_xy.rowRange(row_begin, row_end),
+                  _map_frac.empty() ? cv::Mat() : _map_frac.rowRange(row_begin, row_end), _interpolation,
+                  cv::BORDER_REFLECT);
+    };
+    if (buffer.total() * buffer.elemSize() >= kernel_parallel_min_bytes) {
+        pool.parallel_for(0, buffer.rows, remap_rows, gather_tile_size);
+    } else {
+        remap_rows(0, buffer.rows);
+    }
+    return buffer;
+}
+
+void ImageRegionSampler::_build_maps(const cv::Rect &region, const cv::Size &frame_size, const cv::Size &out_size) {
+    const int max_size = std::numeric_limits<short>::max();
+    if (frame_size.width > max_size || frame_size.height > max_size) {
+        throw std::runtime_error{format("frames of {}x{} are too large to be sampled", frame_size.width,
+                                        frame_size.height)};
+    }
+    _region = region;
+    _frame_size = frame_size;
+    _out_size = out_size;
+
+    cv::Mat map(out_size, CV_32FC2);
+    if (region.size() == out_size) {
+        // the padded part of the region, reflected into the frame
+        for(auto y = 0; y < out_size.height; ++y) {
+            const auto src_y = (float)cv::borderInterpolate(region.y + y, frame_size.height, cv::BORDER_REFLECT);
+            auto row = map.ptr<cv::Vec2f>(y);
+            for(auto x = 0; x < out_size.width; ++x) {
+                row[x] = cv::Vec2f((float)cv::borderInterpolate(region.x + x, frame_size.width, cv::BORDER_REFLECT),
+                                   src_y);
+            }
+        }
+        cv::convertMaps(map, cv::noArray(), _map_xy, _map_frac, CV_16SC2, true);
+        _interpolation = cv::INTER_NEAREST;
+        return;
+    }
+
+    // the sample positions of cv::resize, which clamps them to its input (the padded region); positions outside of
+    // the frame are reflected by remap
+    auto sample_pos = [](int d, int region_begin, int region_size, int out_size) {
+        const double pos = (d + 0.5) * region_size / out_size - 0.5;
+        return (float)(region_begin + std::min(std::max(pos, 0.0), (double)(region_size - 1)));
+    };
+    for(auto y = 0; y < out_size.height; ++y) {
+        const float src_y = sample_pos(y, region.y, region.height, out_size.height);
+        auto row = map.ptr<cv::Vec2f>(y);
+        for(auto x = 0; x < out_size.width; ++x) {
+            row[x] = cv::Vec2f(sample_pos(x, region.x, region.width, out_size.width), src_y);
+        }
+    }
+    cv::convertMaps(map, cv::noArray(), _map_xy, _map_frac, CV_16SC2, false);
+    _interpolation = cv::INTER_LINEAR;
+}
+
 cv::Mat VideoScramblePipeline::extract_image_region(const cv::Mat &img, const ImageDataTransform &info) {
+    cv::Mat padded_buffer, ret;
+    extract_image_region(img, info, padded_buffer, ret);
+    return ret;
+}
+
+void VideoScramblePipeline::extract_image_region(const cv::Mat &img, const ImageDataTransform &info,
+                                                 cv::Mat &padded_buffer, cv::Mat &out) {
     // estimate transformation scale
 
     auto roi = get_padded_roi(img, lround(info.image_region_x), lround(info.image_region_y),
-                                lround(info.image_region_width), lround(info.image_region_height));
+                                lround(info.image_region_width), lround(info.image_region_height), padded_buffer);
 
-    cv::resize(roi, roi, cv::Size(info.original_image_region_width, info.original_image_region_height));
-
-    return roi;
+    cv::resize(roi, out, cv::Size(info.original_image_region_width, info.original_image_region_height));
 }
 
 void VideoScramblePipeline::sync_state(const nlohmann::json &data) {
@@ -465,6 +924,10 @@ void VideoScramblePipeline::sync_state(const std::string &data) {
     sync_state(json_data);
 }
 
+void VideoScramblePipeline::sync_state(const ScramblerState &state) {
+    _state.timestamp = state.timestamp;
+}
+
 int VideoScramblePipeline::get_data_embed_interval() const {
     return _data_embed_interval;
 }
@@ -474,6 +937,76 @@ void VideoScramblePipeline::set_data_embed_interval(int interval) {
         throw std::runtime_error{"data embed interval must be at least 1"};
     }
     _data_embed_interval = interval;
+    if (_fit) {
+        _update_data_band();
+    }
+}
+
+DataCompression VideoScramblePipeline::get_data_compression() const {
+    return _data_compression;
+}
+
+void VideoScramblePipeline::set_data_compression(DataCompression compression) {
+    _data_compression = compression;
+    if (_fit) {
+        _data_embed->set_compression(compression);
+        // the payload string is unchanged, so the cached band has to be dropped explicitly
+        _data_band = {};
+        _update_data_band();
+    }
+}
+
+ChannelOrder VideoScramblePipeline::get_channel_order() const {
+    return _channel_order;
+}
+
+void VideoScramblePipeline::set_channel_order(ChannelOrder order) {
+    _channel_order = order;
+    if (_fit) {
+        _data_embed->set_channel_order(order);
+        _data_band = {};
+        _update_data_band();
+    }
+}
+
+MetadataFormat VideoScramblePipeline::get_metadata_format() const {
+    return _metadata_format;
+}
+
+void VideoScramblePipeline::set_metadata_format(MetadataFormat format) {
+    _metadata_format = format;
+    if (_fit) {
+        _update_data_band();
+    }
+}
+
+void VideoScramblePipeline::set_permutation_fusion(bool val) {
+    _permutation_fusion = val;
+}
+
+void VideoScramblePipeline::set_num_threads(int num_threads) {
+    if (num_threads < 0) {
+        throw std::runtime_error{format("invalid number of threads {}", num_threads)};
+    }
+    _thread_pool = num_threads == 0 ? nullptr : std::make_shared<ThreadPool>(num_threads);
+}
+
+int VideoScramblePipeline::get_num_threads() const {
+    return _get_thread_pool().get_num_threads();
+}
+
+std::vector<StageStats> VideoScramblePipeline::get_stats() const {
+    return _stats ? _stats->get() : std::vector<StageStats>();
+}
+
+void VideoScramblePipeline::reset_stats() {
+    if (_stats) {
+        _stats->reset();
+    }
+}
+
+ThreadPool &VideoScramblePipeline::_get_thread_pool() const {
+    return _thread_pool ? *_thread_pool : get_default_thread_pool();
 }
 
 
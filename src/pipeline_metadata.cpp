@@ -0,0 +1,258 @@
+#include "pipeline_metadata.h"
+#include <limits>
+#include <zlib.h>
+
+
+// wire ids and json keys of the step parameters, in the order of the constructor arguments
+struct StepSchema {
+    ScramblerType type;
+    uint8_t id;
+    const char *name;
+    int num_params;
+    std::array<const char*, pipeline_metadata_max_params> params;
+};
+
+static const std::array<StepSchema, 4> step_schemas{{
+    {ScramblerType::ImageTranspose, 1, "ImageTranspose", 0, {}},
+    {ScramblerType::RowShuffle, 2, "RowShuffle", 2, {"row_group_size", "random_seed"}},
+    {ScramblerType::RowMix, 3, "RowMix", 2, {"row_group_size", "random_seed"}},
+    {ScramblerType::ImageShift, 4, "ImageShift", 2, {"sx", "sy"}},
+}};
+
+static const StepSchema *find_step_schema(ScramblerType type) {
+    for(const auto &schema : step_schemas) {
+        if (schema.type == type) {
+            return &schema;
+        }
+    }
+    return nullptr;
+}
+
+static const StepSchema *find_step_schema(uint8_t id) {
+    for(const auto &schema : step_schemas) {
+        if (schema.id == id) {
+            return &schema;
+        }
+    }
+    return nullptr;
+}
+
+
+static void write_varint(std::string &out, uint64_t v) {
+    while(v >= 0x80) {
+        out.push_back((char)((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    out.push_back((char)v);
+}
+
+static uint64_t zigzag_encode(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t zigzag_decode(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+// reads from [pos, end) and advances pos; false when the varint is truncated or too long
+static bool read_varint(const uint8_t *&pos, const uint8_t *end, uint64_t &v) {
+    v = 0;
+    for(auto shift = 0; shift < 64; shift += 7) {
+        if (pos == end) {
+            return false;
+        }
+        const uint8_t b = *pos++;
+        v |= (uint64_t)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+template<typename T>
+static bool read_varint_as(const uint8_t *&pos, const uint8_t *end, T &out) {
+    uint64_t v;
+    if (!read_varint(pos, end, v) || v > (uint64_t)std::numeric_limits<T>::max()) {
+        return false;
+    }
+    out = (T)v;
+    return true;
+}
+
+
+bool is_binary_pipeline_metadata(const char *data, size_t size) {
+    return size >= pipeline_metadata_magic.size() &&
+           (uint8_t)data[0] == pipeline_metadata_magic[0] && (uint8_t)data[1] == pipeline_metadata_magic[1];
+}
+
+std::string encode_pipeline_metadata(const PipelineMetadata &metadata) {
+    if (metadata.num_steps < 0 || metadata.num_steps > pipeline_metadata_max_steps) {
+        throw std::runtime_error{format("invalid number of steps {}", metadata.num_steps)};
+    }
+
+    std::string ret(pipeline_metadata_magic.begin(), pipeline_metadata_magic.end());
+    ret.push_back((char)pipeline_metadata_version);
+    for(size_t v : {(size_t)metadata.data_embed_block_size, (size_t)metadata.data_embed_num_rows,
+                    (size_t)metadata.data_embed_interval,
+                    metadata.state.output_width_wo_data, metadata.state.output_height_wo_data,
+                    metadata.state.data_region_width, metadata.state.data_region_height,
+                    metadata.state.input_width, metadata.state.input_height,
+                    (size_t)metadata.num_steps}) {
+        write_varint(ret, v);
+    }
+    for(auto i = 0; i < metadata.num_steps; ++i) {
+        const auto &step = metadata.steps[i];
+        const auto *schema = find_step_schema(step.type);
+        if (schema == nullptr) {
+            throw std::runtime_error{format("step {} has no binary representation", i)};
+        }
+        ret.push_back((char)schema->id);
+        for(auto j = 0; j < schema->num_params; ++j) {
+            write_varint(ret, zigzag_encode(step.params[j]));
+        }
+    }
+
+    const uint32_t crc = crc32(0L, reinterpret_cast<const Bytef*>(ret.data()), (uInt)ret.size());
+    for(auto i = 0; i < 4; ++i) {
+        ret.push_back((char)((crc >> (8 * i)) & 0xFF));
+    }
+    return ret;
+}
+
+bool decode_pipeline_metadata(const char *data, size_t size, PipelineMetadata &metadata) {
+    constexpr const size_t crc_size = 4;
+    if (!is_binary_pipeline_metadata(data, size) || size < pipeline_metadata_magic.size() + 1 + crc_size) {
+        return false;
+    }
+    auto pos = reinterpret_cast<const uint8_t*>(data);
+    const auto end = pos + size - crc_size;
+
+    uint32_t stored_crc = 0;
+    for(auto i = 0; i < 4; ++i) {
+        stored_crc |= (uint32_t)end[i] << (8 * i);
+    }
+    if (crc32(0L, pos, (uInt)(size - crc_size)) != stored_crc) {
+        return false;
+    }
+
+    pos += pipeline_metadata_magic.size();
+    if (*pos++ != pipeline_metadata_version) {
+        return false;
+    }
+
+    auto &state = metadata.state;
+    if (!read_varint_as(pos, end, metadata.data_embed_block_size) ||
+        !read_varint_as(pos, end, metadata.data_embed_num_rows) ||
+        !read_varint_as(pos, end, metadata.data_embed_interval) ||
+        !read_varint_as(pos, end, state.output_width_wo_data) ||
+        !read_varint_as(pos, end, state.output_height_wo_data) ||
+        !read_varint_as(pos, end, state.data_region_width) ||
+        !read_varint_as(pos, end, state.data_region_height) ||
+        !read_varint_as(pos, end, state.input_width) ||
+        !read_varint_as(pos, end, state.input_height) ||
+        !read_varint_as(pos, end, metadata.num_steps) ||
+        metadata.num_steps > pipeline_metadata_max_steps) {
+        return false;
+    }
+
+    for(auto i = 0; i < metadata.num_steps; ++i) {
+        if (pos == end) {
+            return false;
+        }
+        const auto *schema = find_step_schema(*pos++);
+        if (schema == nullptr) {
+            return false;
+        }
+        auto &step = metadata.steps[i];
+        step.type = schema->type;
+        step.params.fill(0);
+        for(auto j = 0; j < schema->num_params; ++j) {
+            uint64_t v;
+            if (!read_varint(pos, end, v)) {
+                return false;
+            }
+            const int64_t param = zigzag_decode(v);
+            if (param < std::numeric_limits<int>::min() || param > std::numeric_limits<int>::max()) {
+                return false;
+            }
+            step.params[j] = (int)param;
+        }
+    }
+    return pos == end;
+}
+
+nlohmann::ordered_json pipeline_metadata_to_json(const PipelineMetadata &metadata) {
+    nlohmann::ordered_json ret;
+    // steps are plain json objects, as ScramblerBase::to_json() builds them
+    std::vector<nlohmann::json> steps;
+    for(auto i = 0; i < metadata.num_steps; ++i) {
+        const auto &step = metadata.steps[i];
+        const auto *schema = find_step_schema(step.type);
+        if (schema == nullptr) {
+            throw std::runtime_error{format("step {} has an unknown type", i)};
+        }
+        nlohmann::json step_obj;
+        step_obj["name"] = schema->name;
+        for(auto j = 0; j < schema->num_params; ++j) {
+            step_obj[schema->params[j]] = step.params[j];
+        }
+        steps.emplace_back(std::move(step_obj));
+    }
+    ret["steps"] = steps;
+
+    ret["data_embed_block_size"] = metadata.data_embed_block_size;
+    ret["data_embed_num_rows"] = metadata.data_embed_num_rows;
+    ret["data_embed_interval"] = metadata.data_embed_interval;
+
+    nlohmann::ordered_json state;
+    state["output_width_wo_data"] = metadata.state.output_width_wo_data;
+    state["output_height_wo_data"] = metadata.state.output_height_wo_data;
+    state["data_region_width"] = metadata.state.data_region_width;
+    state["data_region_height"] = metadata.state.data_region_height;
+    state["input_height"] = metadata.state.input_height;
+    state["input_width"] = metadata.state.input_width;
+    ret["state"] = state;
+
+    return ret;
+}
+
+void pipeline_metadata_from_json(const nlohmann::ordered_json &data, PipelineMetadata &metadata) {
+    const auto &steps = data.at("steps");
+    if (steps.size() > pipeline_metadata_max_steps) {
+        throw std::runtime_error{format("at most {} steps are supported, got {}", pipeline_metadata_max_steps,
+                                        steps.size())};
+    }
+    metadata.num_steps = 0;
+    for(const auto &step : steps) {
+        const auto step_name = step.at("name").get<std::string>();
+        const StepSchema *schema = nullptr;
+        for(const auto &s : step_schemas) {
+            if (step_name == s.name) {
+                schema = &s;
+            }
+        }
+        if (schema == nullptr) {
+            throw std::runtime_error{format("unknown scrambler method \"{}\"", step_name)};
+        }
+        auto &out = metadata.steps[metadata.num_steps++];
+        out.type = schema->type;
+        out.params.fill(0);
+        for(auto j = 0; j < schema->num_params; ++j) {
+            out.params[j] = step.at(schema->params[j]).get<int>();
+        }
+    }
+
+    metadata.data_embed_block_size = data.at("data_embed_block_size").get<int>();
+    metadata.data_embed_num_rows = data.at("data_embed_num_rows").get<int>();
+    metadata.data_embed_interval = data.value("data_embed_interval", 1);
+
+    const auto &state = data.at("state");
+    metadata.state.output_width_wo_data = state.at("output_width_wo_data").get<size_t>();
+    metadata.state.output_height_wo_data = state.at("output_height_wo_data").get<size_t>();
+    metadata.state.data_region_width = state.at("data_region_width").get<size_t>();
+    metadata.state.data_region_height = state.at("data_region_height").get<size_t>();
+    metadata.state.input_height = state.at("input_height").get<size_t>();
+    metadata.state.input_width = state.at("input_width").get<size_t>();
+    metadata.state.timestamp = state.value("timestamp", (size_t)0);
+}
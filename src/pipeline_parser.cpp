@@ -45,3 +45,36 @@ std::shared_ptr<VideoScramblePipeline> build_pipeline_from_json(const std::strin
 
     return ret;
 }
+
+std::shared_ptr<VideoScramblePipeline> build_pipeline_from_metadata(const PipelineMetadata &metadata) {
+    auto scrambler_steps = std::make_shared<std::vector<pipeline_step_t>>();
+    for(auto i = 0; i < metadata.num_steps; ++i) {
+        const auto &step = metadata.steps[i];
+        const auto &params = step.params;
+
+        pipeline_step_t new_step;
+        switch(step.type) {
+            case ScramblerType::RowShuffle:
+                new_step = std::make_shared<RowShuffle>(params[0], params[1]);
+                break;
+            case ScramblerType::ImageTranspose:
+                new_step = std::make_shared<ImageTranspose>();
+                break;
+            case ScramblerType::RowMix:
+                new_step = std::make_shared<RowMix>(params[0], params[1]);
+                break;
+            case ScramblerType::ImageShift:
+                new_step = std::make_shared<ImageShift>(params[0], params[1]);
+                break;
+            default:
+                throw std::runtime_error{format("unknown scrambler type of step {}", i)};
+        }
+        scrambler_steps->push_back(new_step);
+    }
+
+    auto ret = std::make_shared<VideoScramblePipeline>(scrambler_steps,
+                                                       metadata.data_embed_block_size,
+                                                       metadata.data_embed_num_rows);
+    ret->set_data_embed_interval(metadata.data_embed_interval);
+    return ret;
+}
@@ -0,0 +1,152 @@
+#include "pipeline_stats.h"
+#include <algorithm>
+
+
+static std::atomic<uint64_t> next_recorder_id{0};
+
+// the owning thread is the only writer, so a load and a store do
+static void add_relaxed(std::atomic<uint64_t> &counter, uint64_t v) {
+    counter.store(counter.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+}
+
+static int latency_bucket(uint64_t ns) {
+    if (ns < 4) {
+        return (int)ns;
+    }
+    int log2 = 2;
+    while(log2 < 63 && (ns >> (log2 + 1)) != 0) {
+        ++log2;
+    }
+    // the two bits below the leading one split the power of two into quarters
+    const int bucket = 4 * log2 + (int)((ns >> (log2 - 2)) & 3) - 4;
+    return std::min(bucket, stats_latency_buckets - 1);
+}
+
+// largest latency of a bucket, in ns
+static double latency_bucket_bound(int bucket) {
+    if (bucket < 4) {
+        return bucket;
+    }
+    const int log2 = (bucket + 4) / 4;
+    const int quarter = (bucket + 4) % 4;
+    return (double)(((uint64_t)(5 + quarter) << (log2 - 2)) - 1);
+}
+
+PipelineStatsRecorder::ThreadCounters::ThreadCounters(size_t num_stages) : _counters(new Counters[num_stages]) {
+
+}
+
+void PipelineStatsRecorder::ThreadCounters::record(size_t stage, std::chrono::steady_clock::duration elapsed,
+                                                   size_t bytes_read, size_t bytes_written, bool reallocated) {
+    auto &c = _counters[stage];
+    const auto ns = (uint64_t)std::max<int64_t>(
+            0, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    add_relaxed(c.num_calls, 1);
+    add_relaxed(c.total_ns, ns);
+    if (ns < c.min_ns.load(std::memory_order_relaxed)) {
+        c.min_ns.store(ns, std::memory_order_relaxed);
+    }
+    if (ns > c.max_ns.load(std::memory_order_relaxed)) {
+        c.max_ns.store(ns, std::memory_order_relaxed);
+    }
+    add_relaxed(c.bytes_read, bytes_read);
+    add_relaxed(c.bytes_written, bytes_written);
+    add_relaxed(c.buffer_reallocations, reallocated ? 1 : 0);
+    add_relaxed(c.latency[latency_bucket(ns)], 1);
+}
+
+PipelineStatsRecorder::PipelineStatsRecorder(std::vector<Stage> stages) : _id(next_recorder_id++),
+                                                                          _stages(std::move(stages)) {
+
+}
+
+PipelineStatsRecorder::ThreadCounters &PipelineStatsRecorder::local() {
+    // counters of the recorders this thread has recorded into, by recorder id
+    thread_local std::vector<std::pair<uint64_t, std::shared_ptr<ThreadCounters>>> registry;
+    for(const auto &entry : registry) {
+        if (entry.first == _id) {
+            return *entry.second;
+        }
+    }
+
+    // counters only the registry still holds belong to recorders that are gone
+    registry.erase(std::remove_if(registry.begin(), registry.end(), [](const auto &entry) {
+        return entry.second.use_count() == 1;
+    }), registry.end());
+
+    auto counters = std::make_shared<ThreadCounters>(_stages.size());
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _threads.push_back(counters);
+    }
+    registry.emplace_back(_id, counters);
+    return *counters;
+}
+
+std::vector<StageStats> PipelineStatsRecorder::get() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    std::vector<StageStats> ret;
+    for(size_t s = 0; s < _stages.size(); ++s) {
+        StageStats stats;
+        stats.name = _stages[s].name;
+        stats.inverse = _stages[s].inverse;
+
+        uint64_t total_ns = 0, min_ns = UINT64_MAX, max_ns = 0;
+        std::array<uint64_t, stats_latency_buckets> latency{};
+        for(const auto &thread : _threads) {
+            const auto &c = thread->_counters[s];
+            stats.num_calls += c.num_calls.load(std::memory_order_relaxed);
+            total_ns += c.total_ns.load(std::memory_order_relaxed);
+            min_ns = std::min(min_ns, c.min_ns.load(std::memory_order_relaxed));
+            max_ns = std::max(max_ns, c.max_ns.load(std::memory_order_relaxed));
+            stats.bytes_read += c.bytes_read.load(std::memory_order_relaxed);
+            stats.bytes_written += c.bytes_written.load(std::memory_order_relaxed);
+            stats.buffer_reallocations += c.buffer_reallocations.load(std::memory_order_relaxed);
+            for(auto b = 0; b < stats_latency_buckets; ++b) {
+                latency[b] += c.latency[b].load(std::memory_order_relaxed);
+            }
+        }
+
+        if (stats.num_calls > 0) {
+            stats.total_ms = total_ns * 1e-6;
+            stats.min_ms = min_ns * 1e-6;
+            stats.max_ms = max_ns * 1e-6;
+            // the counters are read one by one, so the histogram may lag behind num_calls
+            uint64_t num_samples = 0;
+            for(auto n : latency) {
+                num_samples += n;
+            }
+            const uint64_t rank = (num_samples * 99 + 99) / 100;
+            uint64_t seen = 0;
+            for(auto b = 0; b < stats_latency_buckets; ++b) {
+                seen += latency[b];
+                if (seen >= rank && num_samples > 0) {
+                    stats.p99_ms = std::min(latency_bucket_bound(b), (double)max_ns) * 1e-6;
+                    break;
+                }
+            }
+        }
+        ret.push_back(stats);
+    }
+    return ret;
+}
+
+void PipelineStatsRecorder::reset() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for(const auto &thread : _threads) {
+        for(size_t s = 0; s < _stages.size(); ++s) {
+            auto &c = thread->_counters[s];
+            c.num_calls.store(0, std::memory_order_relaxed);
+            c.total_ns.store(0, std::memory_order_relaxed);
+            c.min_ns.store(UINT64_MAX, std::memory_order_relaxed);
+            c.max_ns.store(0, std::memory_order_relaxed);
+            c.bytes_read.store(0, std::memory_order_relaxed);
+            c.bytes_written.store(0, std::memory_order_relaxed);
+            c.buffer_reallocations.store(0, std::memory_order_relaxed);
+            for(auto &n : c.latency) {
+                n.store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+}
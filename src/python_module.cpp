@@ -1,20 +1,168 @@
 #include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
 #include "pipeline.h"
 #include "pipeline_parser.h"
+#include "data_region_tracker.h"
 #include "ndarray_converter.h"
 
 namespace py = pybind11;
 
+// Frames of transform / inverse_transform (and of their _batch variants) cross the module boundary without a copy:
+// the numpy arrays are wrapped by cv::Mat headers over their memory, the output is written straight into the returned
+// (or the given out=) array, and the timestamp overloads run with the GIL released. A frame is a uint8 (H, W, 3) array,
+// a batch a (N, H, W, 3) one; the pixels of a row have to be packed, rows and frames may be strided (e.g. a crop of a
+// larger array).
+
+static bool is_frame_array(const py::array &arr) {
+    const auto ndim = arr.ndim();
+    if (!py::isinstance<py::array_t<uint8_t>>(arr) || (ndim != 3 && ndim != 4) || arr.shape(ndim - 1) != 3) {
+        return false;
+    }
+    if (arr.strides(ndim - 1) != 1 || arr.strides(ndim - 2) != 3 || arr.strides(ndim - 3) < 3 * arr.shape(ndim - 2)) {
+        return false;
+    }
+    return ndim == 3 || arr.strides(0) >= 0;
+}
+
+// the input as is when it can be wrapped, a packed uint8 copy otherwise
+static py::array frames_from_input(const py::handle &img) {
+    py::array arr = py::array::ensure(img);
+    if (!arr || !is_frame_array(arr)) {
+        arr = py::array_t<uint8_t, py::array::c_style | py::array::forcecast>::ensure(img);
+        if (!arr || (arr.ndim() != 3 && arr.ndim() != 4) || arr.shape(arr.ndim() - 1) != 3) {
+            throw std::runtime_error{"expected a (H, W, 3) frame or a (N, H, W, 3) batch of frames"};
+        }
+    }
+    return arr;
+}
+
+// out= when given (it has to match exactly, it is never reallocated), a new array otherwise
+static py::array frames_for_output(const py::object &out, bool batch, py::ssize_t num_frames, const cv::Size &size) {
+    std::vector<py::ssize_t> shape{size.height, size.width, 3};
+    if (batch) {
+        shape.insert(shape.begin(), num_frames);
+    }
+    if (out.is_none()) {
+        return py::array_t<uint8_t>(shape);
+    }
+
+    // anything but an array would be converted to a temporary copy
+    if (!py::isinstance<py::array>(out)) {
+        throw std::runtime_error{"out must be a numpy array"};
+    }
+    auto arr = py::reinterpret_borrow<py::array>(out);
+    // the frames of a batch are written concurrently, so they must not overlap (a broadcast array has a stride of 0)
+    if (!is_frame_array(arr) || std::vector<py::ssize_t>(arr.shape(), arr.shape() + arr.ndim()) != shape ||
+        (batch && arr.strides(0) < arr.shape(1) * arr.strides(1))) {
+        throw std::runtime_error{format("out must be a uint8 array of shape ({}{}, {}, 3) with packed pixels and "
+                                        "frames that do not overlap",
+                                        batch ? std::to_string(num_frames) + ", " : "", size.height, size.width)};
+    }
+    if (!arr.writeable()) {
+        throw std::runtime_error{"out must be writeable"};
+    }
+    return arr;
+}
+
+static std::vector<cv::Mat> frame_views(const py::array &arr) {
+    const bool batch = arr.ndim() == 4;
+    const auto num_frames = batch ? arr.shape(0) : 1;
+    const auto d = batch ? 1 : 0;
+    auto *data = (uchar*)arr.data();
+
+    std::vector<cv::Mat> ret;
+    for(py::ssize_t i = 0; i < num_frames; ++i) {
+        ret.emplace_back((int)arr.shape(d), (int)arr.shape(d + 1), CV_8UC3, data + (batch ? i * arr.strides(0) : 0),
+                         (size_t)arr.strides(d));
+    }
+    return ret;
+}
+
+// fn(frames, out) runs without the GIL when release_gil is set; the arrays are kept alive by the caller's references
+template<typename Fn>
+static py::array run_on_frames(const py::handle &img, const py::object &out, const cv::Size &out_size,
+                               bool release_gil, Fn &&fn) {
+    auto in_arr = frames_from_input(img);
+    const bool batch = in_arr.ndim() == 4;
+    auto out_arr = frames_for_output(out, batch, batch ? in_arr.shape(0) : 1, out_size);
+
+    auto frames = frame_views(in_arr);
+    auto out_frames = frame_views(out_arr);
+    if (release_gil) {
+        py::gil_scoped_release release;
+        fn(frames, out_frames);
+    } else {
+        fn(frames, out_frames);
+    }
+    return out_arr;
+}
+
 
 PYBIND11_MODULE(py_vidscramble, m) {
 
     NDArrayConverter::init_numpy();
 
+    py::enum_<DataCompression>(m, "DataCompression")
+        .value("gzip", DataCompression::gzip)
+        .value("preset_dictionary", DataCompression::preset_dictionary)
+        .value("none", DataCompression::none);
+
+    py::enum_<MetadataFormat>(m, "MetadataFormat")
+        .value("json", MetadataFormat::json)
+        .value("binary", MetadataFormat::binary);
+
+    py::enum_<ChannelOrder>(m, "ChannelOrder")
+        .value("rgb", ChannelOrder::rgb)
+        .value("bgr", ChannelOrder::bgr);
+
+    // a frame, or a batch whose frames get consecutive timestamps from the given one
+    auto transform_at = [](const VideoScramblePipeline &pipeline, const py::handle &img, size_t timestamp,
+                           const py::object &out) {
+        return run_on_frames(img, out, pipeline.get_output_size(), true, [&](const std::vector<cv::Mat> &frames,
+                                                                             std::vector<cv::Mat> &out_frames) {
+            pipeline.transform_batch_into(frames, timestamp, out_frames);
+        });
+    };
+    auto inverse_transform_at = [](const VideoScramblePipeline &pipeline, const py::handle &img,
+                                   const ImageDataTransform &info, size_t timestamp, const py::object &out) {
+        return run_on_frames(img, out, pipeline.get_input_size(), true, [&](const std::vector<cv::Mat> &frames,
+                                                                            std::vector<cv::Mat> &out_frames) {
+            pipeline.inverse_transform_batch_into(frames, info, timestamp, out_frames);
+        });
+    };
+
     py::class_<VideoScramblePipeline, std::shared_ptr<VideoScramblePipeline>>(m, "VideoScramblePipeline")
         .def(py::init<std::shared_ptr<std::vector<pipeline_step_t>>, int, int>())
         .def("fit", &VideoScramblePipeline::fit)
-        .def("transform", &VideoScramblePipeline::transform)
-        .def("inverse_transform", &VideoScramblePipeline::inverse_transform)
+        // the timestamp overloads come first, so that a positional timestamp is not taken for out
+        .def("transform", transform_at, py::arg("img"), py::arg("timestamp"), py::arg("out") = py::none())
+        // these advance the pipeline timestamp, so they keep the GIL: python threads sharing a pipeline cannot run
+        // them concurrently (nor one of them while another thread calls fit or a setter)
+        .def("transform", [](VideoScramblePipeline &pipeline, const py::handle &img, const py::object &out) {
+            return run_on_frames(img, out, pipeline.get_output_size(), false, [&](const std::vector<cv::Mat> &frames,
+                                                                                  std::vector<cv::Mat> &out_frames) {
+                for(size_t i = 0; i < frames.size(); ++i) {
+                    pipeline.transform_into(frames[i], out_frames[i]);
+                }
+            });
+        }, py::arg("img"), py::arg("out") = py::none())
+        .def("inverse_transform", inverse_transform_at, py::arg("img"), py::arg("info"), py::arg("timestamp"),
+             py::arg("out") = py::none())
+        .def("inverse_transform", [](VideoScramblePipeline &pipeline, const py::handle &img,
+                                     const ImageDataTransform &info, const py::object &out) {
+            return run_on_frames(img, out, pipeline.get_input_size(), false, [&](const std::vector<cv::Mat> &frames,
+                                                                                 std::vector<cv::Mat> &out_frames) {
+                for(size_t i = 0; i < frames.size(); ++i) {
+                    pipeline.inverse_transform_into(frames[i], info, out_frames[i]);
+                }
+            });
+        }, py::arg("img"), py::arg("info"), py::arg("out") = py::none())
+        // a list of frames is packed into one (N, H, W, 3) array, the result is such an array
+        .def("transform_batch", transform_at, py::arg("frames"), py::arg("start_timestamp"),
+             py::arg("out") = py::none())
+        .def("inverse_transform_batch", inverse_transform_at, py::arg("frames"), py::arg("info"),
+             py::arg("start_timestamp"), py::arg("out") = py::none())
         .def("reset_timestamp", &VideoScramblePipeline::reset_timestamp)
         .def("set_timestamp_increment", &VideoScramblePipeline::set_timestamp_increment)
         .def("increment_timestamp", &VideoScramblePipeline::increment_timestamp)
@@ -22,10 +170,36 @@ PYBIND11_MODULE(py_vidscramble, m) {
         .def("to_json_image", py::overload_cast<>(&VideoScramblePipeline::to_json_image, py::const_))
         .def("to_json_image", py::overload_cast<const cv::Mat&>(&VideoScramblePipeline::to_json_image, py::const_))
         .def("to_no_data_image", &VideoScramblePipeline::to_no_data_image)
-        .def("get_data_extraction_transform", &VideoScramblePipeline::get_data_extraction_transform)
+        .def("get_data_extraction_transform", py::overload_cast<const cv::Mat&, ImageDataTransform&>(
+                &VideoScramblePipeline::get_data_extraction_transform))
         .def("extract_data", &VideoScramblePipeline::extract_data)
         .def("set_data_embed_interval", &VideoScramblePipeline::set_data_embed_interval)
-        .def("get_data_embed_interval", &VideoScramblePipeline::get_data_embed_interval);
+        .def("get_data_embed_interval", &VideoScramblePipeline::get_data_embed_interval)
+        .def("set_data_compression", &VideoScramblePipeline::set_data_compression)
+        .def("get_data_compression", &VideoScramblePipeline::get_data_compression)
+        .def("set_metadata_format", &VideoScramblePipeline::set_metadata_format)
+        .def("get_metadata_format", &VideoScramblePipeline::get_metadata_format)
+        .def("set_channel_order", &VideoScramblePipeline::set_channel_order)
+        .def("get_channel_order", &VideoScramblePipeline::get_channel_order)
+        .def("set_permutation_fusion", &VideoScramblePipeline::set_permutation_fusion)
+        .def("set_num_threads", &VideoScramblePipeline::set_num_threads)
+        .def("get_num_threads", &VideoScramblePipeline::get_num_threads)
+        .def("get_stats", &VideoScramblePipeline::get_stats)
+        .def("reset_stats", &VideoScramblePipeline::reset_stats);
+
+    py::class_<StageStats>(m, "StageStats")
+        .def_readonly("name", &StageStats::name)
+        .def_readonly("inverse", &StageStats::inverse)
+        .def_readonly("num_calls", &StageStats::num_calls)
+        .def_readonly("total_ms", &StageStats::total_ms)
+        .def_readonly("min_ms", &StageStats::min_ms)
+        .def_readonly("max_ms", &StageStats::max_ms)
+        .def_readonly("p99_ms", &StageStats::p99_ms)
+        .def_readonly("bytes_read", &StageStats::bytes_read)
+        .def_readonly("bytes_written", &StageStats::bytes_written)
+        .def_readonly("buffer_reallocations", &StageStats::buffer_reallocations);
+    // whether the library records stage stats at all
+    m.attr("stats_enabled") = pipeline_stats_enabled;
 
 
     py::class_<ImageDataTransform>(m, "ImageRecoveryInfo")
@@ -39,7 +213,22 @@ PYBIND11_MODULE(py_vidscramble, m) {
         .def_readwrite("original_image_region_height", &ImageDataTransform::original_image_region_height)
         .def_readwrite("original_image_region_width", &ImageDataTransform::original_image_region_width)
         .def_readwrite("original_data_region_width", &ImageDataTransform::original_data_region_width)
-        .def_readwrite("original_data_region_height", &ImageDataTransform::original_data_region_height);
+        .def_readwrite("original_data_region_height", &ImageDataTransform::original_data_region_height)
+        .def_readwrite("channel_order", &ImageDataTransform::channel_order);
+
+    py::class_<DataRegionTracker> tracker(m, "DataRegionTracker");
+    py::enum_<DataRegionTracker::Status>(tracker, "Status")
+        .value("lost", DataRegionTracker::Status::lost)
+        .value("tracked", DataRegionTracker::Status::tracked)
+        .value("detected", DataRegionTracker::Status::detected);
+    tracker
+        .def(py::init<>())
+        .def("update", &DataRegionTracker::update)
+        .def("get_transform", &DataRegionTracker::get_transform)
+        .def("has_transform", &DataRegionTracker::has_transform)
+        .def("reset", &DataRegionTracker::reset)
+        .def("set_channel_order", &DataRegionTracker::set_channel_order)
+        .def("get_channel_order", &DataRegionTracker::get_channel_order);
 
 
     m.def("build_pipeline_from_json", &build_pipeline_from_json);
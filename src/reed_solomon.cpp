@@ -0,0 +1,266 @@
+#include "reed_solomon.h"
+#include "util.h"
+#include <cstring>
+#include <stdexcept>
+
+#if defined(LIBVIDSCRAMBLE_AVX2)
+#include <immintrin.h>
+#elif defined(LIBVIDSCRAMBLE_SSE41)
+#include <smmintrin.h>
+#endif
+
+
+static_assert(rs_code_length == (1 << field_descriptor) - 1, "the code must have the length of the field");
+
+// GF(2^4) log / antilog tables; exp is doubled so the sum of two logs needs no reduction
+struct GaloisTables {
+    uint8_t exp[2 * rs_code_length];
+    uint8_t log[rs_code_length + 1];
+};
+
+static constexpr GaloisTables make_galois_tables() {
+    GaloisTables t{};
+    unsigned int v = 1;
+    for(size_t i = 0; i < rs_code_length; ++i) {
+        t.exp[i] = t.exp[i + rs_code_length] = (uint8_t)v;
+        t.log[v] = (uint8_t)i;
+        v <<= 1;
+        if (v & (1 << field_descriptor)) {
+            v ^= rs_primitive_polynomial;
+        }
+    }
+    return t;
+}
+
+static constexpr GaloisTables gf = make_galois_tables();
+
+static constexpr uint8_t gf_mul(uint8_t a, uint8_t b) {
+    return a == 0 || b == 0 ? 0 : gf.exp[gf.log[a] + gf.log[b]];
+}
+
+// alpha^e for any e >= 0
+static constexpr uint8_t gf_pow(size_t e) {
+    return gf.exp[e % rs_code_length];
+}
+
+// generator polynomial prod (x + alpha^(index + r)), coefficient i belongs to x^i
+static constexpr std::array<uint8_t, rs_fec_length + 1> make_generator() {
+    std::array<uint8_t, rs_fec_length + 1> g{};
+    g[0] = 1;
+    for(size_t r = 0; r < generator_polynomial_root_count; ++r) {
+        const uint8_t root = gf_pow(generator_polynomial_index + r);
+        for(size_t i = r + 1; i > 0; --i) {
+            g[i] = g[i - 1] ^ gf_mul(g[i], root);
+        }
+        g[0] = gf_mul(g[0], root);
+    }
+    return g;
+}
+
+// Symbol tables are indexed by block position (position p has degree rs_code_length - 1 - p) and symbol value and
+// hold one byte per fec symbol / syndrome, so a block is coded by xor-ing one entry per position.
+using symbol_table_t = std::array<std::array<uint32_t, 16>, rs_code_length>;
+
+// parities of a single data symbol: the remainder of v * x^degree modulo the generator, fec(k) in byte k
+static constexpr symbol_table_t make_parity_table() {
+    constexpr auto g = make_generator();
+    symbol_table_t table{};
+    // x^degree mod g, coefficient k belongs to x^k; starts at x^rs_fec_length
+    std::array<uint8_t, rs_fec_length> rem{};
+    for(size_t k = 0; k < rs_fec_length; ++k) {
+        rem[k] = g[k];
+    }
+    for(size_t degree = rs_fec_length; degree < rs_code_length; ++degree) {
+        const size_t p = rs_code_length - 1 - degree;
+        for(uint8_t v = 0; v < 16; ++v) {
+            uint32_t packed = 0;
+            for(size_t k = 0; k < rs_fec_length; ++k) {
+                packed |= (uint32_t)gf_mul(v, rem[rs_fec_length - 1 - k]) << (8 * k);
+            }
+            table[p][v] = packed;
+        }
+        const uint8_t top = rem[rs_fec_length - 1];
+        for(size_t k = rs_fec_length - 1; k > 0; --k) {
+            rem[k] = rem[k - 1] ^ gf_mul(top, g[k]);
+        }
+        rem[0] = gf_mul(top, g[0]);
+    }
+    return table;
+}
+
+// syndromes of a single symbol: v * alpha^((index + j) * degree) in byte j
+static constexpr symbol_table_t make_syndrome_table() {
+    symbol_table_t table{};
+    for(size_t p = 0; p < rs_code_length; ++p) {
+        const size_t degree = rs_code_length - 1 - p;
+        for(uint8_t v = 0; v < 16; ++v) {
+            uint32_t packed = 0;
+            for(size_t j = 0; j < rs_fec_length; ++j) {
+                packed |= (uint32_t)gf_mul(v, gf_pow((generator_polynomial_index + j) * degree)) << (8 * j);
+            }
+            table[p][v] = packed;
+        }
+    }
+    return table;
+}
+
+static constexpr symbol_table_t parity_table = make_parity_table();
+static constexpr symbol_table_t syndrome_table = make_syndrome_table();
+
+static uint32_t compute_syndromes(const int8_t *block) {
+    uint32_t ret = 0;
+    for(size_t p = 0; p < rs_code_length; ++p) {
+        ret ^= syndrome_table[p][block[p] & 0x0F];
+    }
+    return ret;
+}
+
+#if defined(LIBVIDSCRAMBLE_SSE41)
+// GF(2^4) fits a pshufb lookup: the 16 symbols of a block are multiplied by their positional powers of alpha as
+// log + exponent -> antilog. log(0) has the high bit set, so the lookup yields 0 for zero symbols.
+struct SyndromeLanes {
+    alignas(16) uint8_t log[16];
+    alignas(16) uint8_t exp[16];
+    alignas(16) uint8_t symbol_mask[16];
+    // (index + j) * degree mod rs_code_length for every position
+    alignas(16) uint8_t exponent[rs_fec_length][16];
+};
+
+static constexpr SyndromeLanes make_syndrome_lanes() {
+    SyndromeLanes t{};
+    for(size_t i = 0; i < 16; ++i) {
+        t.log[i] = i == 0 ? 0x80 : gf.log[i];
+        t.exp[i] = gf.exp[i % rs_code_length];
+        // the 16th lane is outside of the block
+        t.symbol_mask[i] = i < rs_code_length ? 0x0F : 0x00;
+        for(size_t j = 0; j < rs_fec_length; ++j) {
+            t.exponent[j][i] = i < rs_code_length
+                    ? (uint8_t)((generator_polynomial_index + j) * (rs_code_length - 1 - i) % rs_code_length)
+                    : 0;
+        }
+    }
+    return t;
+}
+
+static constexpr SyndromeLanes syndrome_lanes = make_syndrome_lanes();
+
+// block points to 16 readable bytes
+static uint32_t compute_syndromes_simd(const int8_t *block) {
+    const __m128i log_table = _mm_load_si128(reinterpret_cast<const __m128i*>(syndrome_lanes.log));
+    const __m128i exp_table = _mm_load_si128(reinterpret_cast<const __m128i*>(syndrome_lanes.exp));
+    const __m128i symbol_mask = _mm_load_si128(reinterpret_cast<const __m128i*>(syndrome_lanes.symbol_mask));
+    const __m128i order_minus_one = _mm_set1_epi8((char)(rs_code_length - 1));
+    const __m128i order = _mm_set1_epi8((char)rs_code_length);
+
+    const __m128i symbols = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block)), symbol_mask);
+    const __m128i logs = _mm_shuffle_epi8(log_table, symbols);
+
+    uint32_t ret = 0;
+    for(size_t j = 0; j < rs_fec_length; ++j) {
+        __m128i e = _mm_add_epi8(logs, _mm_load_si128(reinterpret_cast<const __m128i*>(syndrome_lanes.exponent[j])));
+        // logs of zero stay negative and are left alone
+        e = _mm_sub_epi8(e, _mm_and_si128(_mm_cmpgt_epi8(e, order_minus_one), order));
+        __m128i terms = _mm_shuffle_epi8(exp_table, e);
+        terms = _mm_xor_si128(terms, _mm_srli_si128(terms, 8));
+        terms = _mm_xor_si128(terms, _mm_srli_si128(terms, 4));
+        terms = _mm_xor_si128(terms, _mm_srli_si128(terms, 2));
+        terms = _mm_xor_si128(terms, _mm_srli_si128(terms, 1));
+        ret |= (uint32_t)(_mm_cvtsi128_si32(terms) & 0xFF) << (8 * j);
+    }
+    return ret;
+}
+#endif
+
+// encodes rs_data_length symbols into a code block
+static void encode_block(const char *data, int8_t *out) {
+    uint32_t parities = 0;
+    for(size_t p = 0; p < rs_data_length; ++p) {
+        parities ^= parity_table[p][data[p] & 0x0F];
+    }
+    std::memcpy(out, data, rs_data_length);
+    for(size_t k = 0; k < rs_fec_length; ++k) {
+        out[rs_data_length + k] = (int8_t)((parities >> (8 * k)) & 0xFF);
+    }
+}
+
+// writes the corrected data symbols of a block with the given syndromes; false when the block is not correctable
+static bool decode_block(const int8_t *block, uint32_t syndromes, int8_t *out) {
+    std::memcpy(out, block, rs_data_length);
+    if (syndromes == 0) {
+        return true;
+    }
+
+    // a single error of value e at degree d gives S_j = e * alpha^((index + j) * d)
+    uint8_t s[rs_fec_length];
+    for(size_t j = 0; j < rs_fec_length; ++j) {
+        s[j] = (syndromes >> (8 * j)) & 0xFF;
+        if (s[j] == 0) {
+            return false;
+        }
+    }
+    const size_t degree = (gf.log[s[1]] + rs_code_length - gf.log[s[0]]) % rs_code_length;
+    for(size_t j = 2; j < rs_fec_length; ++j) {
+        if ((gf.log[s[j]] + rs_code_length - gf.log[s[j - 1]]) % rs_code_length != degree) {
+            return false;
+        }
+    }
+    const size_t error_log = (gf.log[s[0]] + rs_code_length - generator_polynomial_index * degree % rs_code_length)
+            % rs_code_length;
+
+    // errors in the fec symbols need no correction
+    const size_t p = rs_code_length - 1 - degree;
+    if (p < rs_data_length) {
+        out[p] ^= (int8_t)gf.exp[error_log];
+    }
+    return true;
+}
+
+size_t rs_encoded_size(size_t size) {
+    return (size + rs_data_length - 1) / rs_data_length * rs_code_length;
+}
+
+void rs_encode_blocks(const char *data, size_t size, int8_t *out) {
+    const size_t num_full_blocks = size / rs_data_length;
+    for(size_t b = 0; b < num_full_blocks; ++b) {
+        encode_block(data + b * rs_data_length, out + b * rs_code_length);
+    }
+    const size_t tail = size - num_full_blocks * rs_data_length;
+    if (tail > 0) {
+        char last[rs_data_length] = {};
+        std::memcpy(last, data + num_full_blocks * rs_data_length, tail);
+        encode_block(last, out + num_full_blocks * rs_code_length);
+    }
+}
+
+void rs_decode_blocks(const int8_t *enc, size_t num_blocks, int8_t *out) {
+    for(size_t b = 0; b < num_blocks; ++b) {
+        const int8_t *block = enc + b * rs_code_length;
+#if defined(LIBVIDSCRAMBLE_SSE41)
+        // the vector load reads one byte past the block, so the last block takes the scalar path
+        const uint32_t syndromes = b + 1 < num_blocks ? compute_syndromes_simd(block) : compute_syndromes(block);
+#else
+        const uint32_t syndromes = compute_syndromes(block);
+#endif
+        if (!decode_block(block, syndromes, out + b * rs_data_length)) {
+            throw std::runtime_error{format("reed solomon block {} has more errors than can be corrected", b)};
+        }
+    }
+}
+
+std::array<int8_t, rs_code_length> rs_encode_block(const char *data, int size) {
+    if (size < 0 || size > rs_data_length) {
+        throw std::runtime_error{"invalid data size"};
+    }
+    std::array<int8_t, rs_code_length> ret;
+    rs_encode_blocks(data, size, ret.data());
+    if (size == 0) {
+        ret.fill(0x00);
+    }
+    return ret;
+}
+
+std::array<int8_t, rs_data_length> rs_decode_block(const char *data) {
+    std::array<int8_t, rs_data_length> ret;
+    rs_decode_blocks(reinterpret_cast<const int8_t*>(data), 1, ret.data());
+    return ret;
+}
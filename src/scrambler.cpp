@@ -1,21 +1,54 @@
 #include "scrambler.h"
+#include "scrambler_kernels.h"
+
+
+bool is_static_permutation(ScramblerType type) {
+    return type == ScramblerType::ImageTranspose || type == ScramblerType::RowShuffle;
+}
+
+bool is_view_only(ScramblerType type) {
+    return type == ScramblerType::ImageTranspose || type == ScramblerType::ImageShift;
+}
+
+
+FrameView ScramblerBase::transform_view(const ScramblerState &state, const FrameView &img, cv::Mat &buffer,
+                                        ThreadPool &pool) const {
+    buffer = transform(state, img.to_mat(pool));
+    return FrameView(buffer);
+}
+
+FrameView ScramblerBase::inverse_transform_view(const ScramblerState &state, const FrameView &img, cv::Mat &buffer,
+                                                ThreadPool &pool) const {
+    buffer = inverse_transform(state, img.to_mat(pool));
+    return FrameView(buffer);
+}
 
 
 // trivial
 void ImageTranspose::fit(ScramblerState &state, const cv::Mat &img) {_fit = true;}
 
-cv::Mat ImageTranspose::transform(ScramblerState &state, const cv::Mat &img) const {
+cv::Mat ImageTranspose::transform(const ScramblerState &state, const cv::Mat &img) const {
     cv::Mat ret;
-    cv::transpose(img, ret);
+    transpose_into(img, ret, get_default_thread_pool());
     return ret;
 }
 
-cv::Mat ImageTranspose::inverse_transform(ScramblerState &state, const cv::Mat &img) const {
+cv::Mat ImageTranspose::inverse_transform(const ScramblerState &state, const cv::Mat &img) const {
     cv::Mat ret;
-    cv::transpose(img, ret);
+    transpose_into(img, ret, get_default_thread_pool());
     return ret;
 }
 
+FrameView ImageTranspose::transform_view(const ScramblerState &state, const FrameView &img, cv::Mat &buffer,
+                                         ThreadPool &pool) const {
+    return img.transposed();
+}
+
+FrameView ImageTranspose::inverse_transform_view(const ScramblerState &state, const FrameView &img, cv::Mat &buffer,
+                                                 ThreadPool &pool) const {
+    return img.transposed();
+}
+
 nlohmann::json ImageTranspose::to_json() const {
     nlohmann::json ret;
     ret["name"] = "ImageTranspose";
@@ -59,62 +92,43 @@ void RowShuffle::fit(ScramblerState &state, const cv::Mat &img) {
     _fit = true;
 }
 
-cv::Mat RowShuffle::transform(ScramblerState &state, const cv::Mat &img) const {
+void RowShuffle::_transform_impl(const FrameView &img, bool inverse, cv::Mat &out, ThreadPool &pool) const {
     _assert_fit();
 
     // shape check
-    if(img.rows != _num_rows) {
-        throw std::runtime_error{format("expected {} rows in the input image, get {}", _num_rows, img.rows)};
-    }
-
-    cv::Mat img_pad = img; // shallow copy
-    // pad
-    if(_pad > 0) {
-        cv::copyMakeBorder(img, img_pad, 0, _pad, 0, 0, cv::BORDER_REFLECT);
+    const int expected_rows = inverse ? _num_rows_after_pad : _num_rows;
+    if(img.rows() != expected_rows) {
+        throw std::runtime_error{format("expected {} rows in the input image, get {}", expected_rows, img.rows())};
     }
 
-    // generate result
-    cv::Mat ret(img_pad.rows, img_pad.cols, img_pad.type());
-
-
-    // forward permutation
-    for(auto i = 0; i < _forward_permutation.size(); ++i) {
-        auto perm_loc = _forward_permutation[i];
-        auto row_start_src = i * _row_group_size;
-        auto row_start_dst = perm_loc * _row_group_size;
-        for(auto j = 0; j < _row_group_size; ++j) {
-            img_pad.row(row_start_src + j).copyTo(ret.row(row_start_dst + j));
-        }
-    }
+    // generate result; the padding rows are reflected on the fly, and rows of the last group past the end of the
+    // image are the padding when going backwards
+    out.create(inverse ? _num_rows : _num_rows_after_pad, img.cols(), img.type());
+    row_group_shuffle(img, out, _forward_permutation, _row_group_size, inverse, pool);
+}
 
+cv::Mat RowShuffle::transform(const ScramblerState &state, const cv::Mat &img) const {
+    cv::Mat ret;
+    _transform_impl(FrameView(img), false, ret, get_default_thread_pool());
     return ret;
 }
 
-cv::Mat RowShuffle::inverse_transform(ScramblerState &state, const cv::Mat &img) const {
-    _assert_fit();
-
-    // shape check
-    if(img.rows != _num_rows_after_pad) {
-        throw std::runtime_error{format("expected {} rows in the input image, get {}", _num_rows_after_pad, img.rows)};
-    }
-
-    cv::Mat ret(_num_rows, img.cols, img.type());
+cv::Mat RowShuffle::inverse_transform(const ScramblerState &state, const cv::Mat &img) const {
+    cv::Mat ret;
+    _transform_impl(FrameView(img), true, ret, get_default_thread_pool());
+    return ret;
+}
 
-    // backwards permutation
-    for(auto i = 0; i < _forward_permutation.size(); ++i) {
-        auto perm_loc = _forward_permutation[i];
-        auto row_start_src = perm_loc * _row_group_size;
-        auto row_start_dst = i * _row_group_size;
-        for(auto j = 0; j < _row_group_size; ++j) {
-            auto dst_row = row_start_dst + j;
-            if (dst_row >= ret.rows) {
-                break;
-            }
-            img.row(row_start_src + j).copyTo(ret.row(dst_row));
-        }
-    }
+FrameView RowShuffle::transform_view(const ScramblerState &state, const FrameView &img, cv::Mat &buffer,
+                                     ThreadPool &pool) const {
+    _transform_impl(img, false, buffer, pool);
+    return FrameView(buffer);
+}
 
-    return ret;
+FrameView RowShuffle::inverse_transform_view(const ScramblerState &state, const FrameView &img, cv::Mat &buffer,
+                                             ThreadPool &pool) const {
+    _transform_impl(img, true, buffer, pool);
+    return FrameView(buffer);
 }
 
 nlohmann::json RowShuffle::to_json() const {
@@ -166,17 +180,15 @@ void RowMix::fit(ScramblerState &state, const cv::Mat &img) {
     _fit = true;
 }
 
-cv::Mat RowMix::_transform_impl(ScramblerState &state, const cv::Mat &img, bool inverse) const {
+void RowMix::_transform_impl(const ScramblerState &state, const FrameView &img, bool inverse, cv::Mat &out,
+                             ThreadPool &pool) const {
     _assert_fit();
 
     // shape check
-    if(img.rows != _num_rows) {
-        throw std::runtime_error{format("expected {} rows in the input image, get {}", _num_rows, img.rows)};
+    if(img.rows() != _num_rows) {
+        throw std::runtime_error{format("expected {} rows in the input image, get {}", _num_rows, img.rows())};
     }
 
-    // divide rows into two groups
-    auto num_rows_per_group = _num_rows / 2;
-
     // get the type info of the matrix
     auto mat_type_info = get_opencv_mat_data_info(img.type());
 
@@ -187,80 +199,34 @@ cv::Mat RowMix::_transform_impl(ScramblerState &state, const cv::Mat &img, bool
         };
     }
 
-    // build a new matrix of bigger type for storage
-    int new_row_dt = CV_16S;
-    cv::Mat row0, row1;
-    cv::Mat row_a, row_b;
-
-    cv::Mat ret(img.rows, img.cols, img.type());
-
-    for(auto i = 0; i < num_rows_per_group; ++i) {
-        auto row_sum_group_ind = i / _row_group_size;
-        auto row_sum_group_offset = i % _row_group_size;
-
-        auto row_diff_group_ind = (i + num_rows_per_group) / _row_group_size;
-        auto row_diff_group_offset = (i + num_rows_per_group) % _row_group_size;
-
-        auto row_sum_row = _row_group_size * _forward_permutation[row_sum_group_ind] + row_sum_group_offset;
-        auto row_diff_row = _row_group_size * _forward_permutation[row_diff_group_ind] + row_diff_group_offset;
-
-        if (!inverse) {
-            // forward transform
-
-            img.row(i).convertTo(row0, new_row_dt);
-            img.row(i + num_rows_per_group).convertTo(row1, new_row_dt);
-
-            row_a = (row0 + row1) / 2;
-            row_b = (row0 - row1) / 2;
-
-            // put the sum information in the ret
-            row_a.convertTo(ret.row(row_sum_row), img.type()); // we need this intermediate step because row0 and ret need to have the same type
-
-            // need to map the negative side of row_diff to positive for uint8 encoding
-            auto num_elements = row_b.total() * row_b.channels();
-            auto row_diff_data = reinterpret_cast<int16_t*>(row_b.data);
-            for(size_t j = 0; j < num_elements; ++j) {
-                if(row_diff_data[j] < 0) {
-                    row_diff_data[j] = (int16_t)256 + row_diff_data[j];
-                }
-            }
-
-            row_b.convertTo(ret.row(row_diff_row), img.type());
-
-        } else {
-
-            img.row(row_sum_row).convertTo(row0, new_row_dt); // row sum
-            img.row(row_diff_row).convertTo(row1, new_row_dt); // row diff
-
-            // remap row_diff
-            auto num_elements = row1.total() * row1.channels();
-            auto row1_data = reinterpret_cast<int16_t*>(row1.data);
-            for(size_t j = 0; j < num_elements; ++j) {
-                if(row1_data[j] > 127) {
-                    row1_data[j] = row1_data[j] - (int16_t)256;
-                }
-            }
-
-            row_a = row0 + row1;
-            row_b = row0 - row1;
-
-            row_a.convertTo(ret.row(i), img.type());
-            row_b.convertTo(ret.row(i+num_rows_per_group), img.type());
-        }
-
-    }
+    // the kernel computes the sum/difference mapping directly on the uint8 rows
+    out.create(img.rows(), img.cols(), img.type());
+    row_mix(img, out, _forward_permutation, _row_group_size, inverse, pool);
+}
 
 
+cv::Mat RowMix::transform(const ScramblerState &state, const cv::Mat &img) const {
+    cv::Mat ret;
+    _transform_impl(state, FrameView(img), false, ret, get_default_thread_pool());
     return ret;
 }
 
+cv::Mat RowMix::inverse_transform(const ScramblerState &state, const cv::Mat &img) const {
+    cv::Mat ret;
+    _transform_impl(state, FrameView(img), true, ret, get_default_thread_pool());
+    return ret;
+}
 
-cv::Mat RowMix::transform(ScramblerState &state, const cv::Mat &img) const {
-    return _transform_impl(state, img, false);
+FrameView RowMix::transform_view(const ScramblerState &state, const FrameView &img, cv::Mat &buffer,
+                                 ThreadPool &pool) const {
+    _transform_impl(state, img, false, buffer, pool);
+    return FrameView(buffer);
 }
 
-cv::Mat RowMix::inverse_transform(ScramblerState &state, const cv::Mat &img) const {
-    return _transform_impl(state, img, true);
+FrameView RowMix::inverse_transform_view(const ScramblerState &state, const FrameView &img, cv::Mat &buffer,
+                                         ThreadPool &pool) const {
+    _transform_impl(state, img, true, buffer, pool);
+    return FrameView(buffer);
 }
 
 nlohmann::json RowMix::to_json() const {
@@ -279,14 +245,32 @@ void ImageShift::fit(ScramblerState &state, const cv::Mat &img) {
     _fit = true;
 }
 
-cv::Mat ImageShift::transform(ScramblerState &state, const cv::Mat &img) const {
+cv::Point ImageShift::get_offset(const ScramblerState &state, const cv::Size &size, bool inverse) const {
     auto ts = state.timestamp;
-    return translate_wrap(img, ts * _sx, ts * _sy);
+    if (!inverse) {
+        return normalize_wrap_offset(ts * _sx, ts * _sy, size.width, size.height);
+    }
+    return normalize_wrap_offset(-ts * _sx, -ts * _sy, size.width, size.height);
 }
 
-cv::Mat ImageShift::inverse_transform(ScramblerState &state, const cv::Mat &img) const {
-    auto ts = state.timestamp;
-    return translate_wrap(img, -ts * _sx, -ts * _sy);
+cv::Mat ImageShift::transform(const ScramblerState &state, const cv::Mat &img) const {
+    auto offset = get_offset(state, img.size(), false);
+    return translate_wrap(img, offset.x, offset.y);
+}
+
+cv::Mat ImageShift::inverse_transform(const ScramblerState &state, const cv::Mat &img) const {
+    auto offset = get_offset(state, img.size(), true);
+    return translate_wrap(img, offset.x, offset.y);
+}
+
+FrameView ImageShift::transform_view(const ScramblerState &state, const FrameView &img, cv::Mat &buffer,
+                                     ThreadPool &pool) const {
+    return img.shifted(get_offset(state, img.size(), false));
+}
+
+FrameView ImageShift::inverse_transform_view(const ScramblerState &state, const FrameView &img, cv::Mat &buffer,
+                                             ThreadPool &pool) const {
+    return img.shifted(get_offset(state, img.size(), true));
 }
 
 nlohmann::json ImageShift::to_json() const {
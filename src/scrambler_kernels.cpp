@@ -0,0 +1,440 @@
+#include "scrambler_kernels.h"
+#include <cstring>
+
+#if defined(LIBVIDSCRAMBLE_AVX2)
+#include <immintrin.h>
+#elif defined(LIBVIDSCRAMBLE_SSE41)
+#include <smmintrin.h>
+#endif
+
+
+static bool use_parallel(const cv::Mat &img) {
+    return img.total() * img.elemSize() >= kernel_parallel_min_bytes;
+}
+
+// walks the row groups of a shuffle; copy_rows(src_row, dst_row, num_rows) moves rows that exist in the source
+template <typename CopyRows>
+static void row_group_shuffle_impl(int src_rows, cv::Mat &dst, const std::vector<int> &perm, int row_group_size,
+                                   bool inverse, ThreadPool &pool, CopyRows copy_rows) {
+    auto copy_group = [&](int group) {
+        const int src_group = inverse ? perm[group] : group;
+        const int dst_group = inverse ? group : perm[group];
+        const int src_row = src_group * row_group_size;
+        const int dst_row = dst_group * row_group_size;
+
+        // rows that exist in both images can be moved as a block
+        const int num_rows = std::min(row_group_size, dst.rows - dst_row);
+        const int num_direct_rows = std::max(0, std::min(num_rows, src_rows - src_row));
+        if (num_direct_rows > 0) {
+            copy_rows(src_row, dst_row, num_direct_rows);
+        }
+
+        // reflected padding rows below the source image
+        for(auto j = num_direct_rows; j < num_rows; ++j) {
+            copy_rows(cv::borderInterpolate(src_row + j, src_rows, cv::BORDER_REFLECT), dst_row + j, 1);
+        }
+    };
+
+    auto copy_groups = [&](int group_begin, int group_end) {
+        for(auto i = group_begin; i < group_end; ++i) {
+            copy_group(i);
+        }
+    };
+
+    if (use_parallel(dst)) {
+        pool.parallel_for(0, (int)perm.size(), copy_groups);
+    } else {
+        copy_groups(0, (int)perm.size());
+    }
+}
+
+void row_group_shuffle(const cv::Mat &src, cv::Mat &dst, const std::vector<int> &perm, int row_group_size,
+                       bool inverse, ThreadPool &pool) {
+    CV_Assert(src.type() == dst.type() && src.cols == dst.cols);
+
+    const size_t row_bytes = src.cols * src.elemSize();
+    // whole row groups are contiguous in memory when neither image has row padding
+    const bool contiguous = src.isContinuous() && dst.isContinuous();
+
+    row_group_shuffle_impl(src.rows, dst, perm, row_group_size, inverse, pool,
+                           [&](int src_row, int dst_row, int num_rows) {
+        if (contiguous) {
+            std::memcpy(dst.ptr(dst_row), src.ptr(src_row), num_rows * row_bytes);
+        } else {
+            for(auto j = 0; j < num_rows; ++j) {
+                std::memcpy(dst.ptr(dst_row + j), src.ptr(src_row + j), row_bytes);
+            }
+        }
+    });
+}
+
+void row_group_shuffle(const FrameView &src, cv::Mat &dst, const std::vector<int> &perm, int row_group_size,
+                       bool inverse, ThreadPool &pool) {
+    if (src.is_plain()) {
+        row_group_shuffle(src.base(), dst, perm, row_group_size, inverse, pool);
+        return;
+    }
+    CV_Assert(src.type() == dst.type() && src.cols() == dst.cols);
+
+    row_group_shuffle_impl(src.rows(), dst, perm, row_group_size, inverse, pool,
+                           [&](int src_row, int dst_row, int num_rows) {
+        cv::Mat dst_rows = dst.rowRange(dst_row, dst_row + num_rows);
+        src.read(cv::Rect(0, src_row, src.cols(), num_rows), dst_rows, pool);
+    });
+}
+
+
+// round half to even of v / 2, for v in 16 bit lanes; the arithmetic shift keeps the sign for differences
+static inline int16_t half_round_even(int16_t v) {
+    int16_t q = v >> 1;
+    return q + (v & q & 1);
+}
+
+#if defined(LIBVIDSCRAMBLE_SSE41)
+static inline __m128i half_round_even(__m128i v) {
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i q = _mm_srai_epi16(v, 1);
+    return _mm_add_epi16(q, _mm_and_si128(_mm_and_si128(v, q), one));
+}
+#endif
+
+#if defined(LIBVIDSCRAMBLE_AVX2)
+static inline __m256i half_round_even(__m256i v) {
+    const __m256i one = _mm256_set1_epi16(1);
+    __m256i q = _mm256_srai_epi16(v, 1);
+    return _mm256_add_epi16(q, _mm256_and_si256(_mm256_and_si256(v, q), one));
+}
+#endif
+
+void row_mix_forward(const uchar *row0, const uchar *row1, uchar *sum, uchar *diff, size_t n) {
+    size_t i = 0;
+#if defined(LIBVIDSCRAMBLE_AVX2)
+    const __m256i low_byte = _mm256_set1_epi16(0xFF);
+    for(; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row0 + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row1 + i));
+        __m256i a_lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(a));
+        __m256i a_hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(a, 1));
+        __m256i b_lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(b));
+        __m256i b_hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(b, 1));
+
+        __m256i s_lo = half_round_even(_mm256_add_epi16(a_lo, b_lo));
+        __m256i s_hi = half_round_even(_mm256_add_epi16(a_hi, b_hi));
+        __m256i d_lo = _mm256_and_si256(half_round_even(_mm256_sub_epi16(a_lo, b_lo)), low_byte);
+        __m256i d_hi = _mm256_and_si256(half_round_even(_mm256_sub_epi16(a_hi, b_hi)), low_byte);
+
+        // packus interleaves the 128 bit lanes, the permute restores the element order
+        __m256i s = _mm256_permute4x64_epi64(_mm256_packus_epi16(s_lo, s_hi), 0xD8);
+        __m256i d = _mm256_permute4x64_epi64(_mm256_packus_epi16(d_lo, d_hi), 0xD8);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(sum + i), s);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(diff + i), d);
+    }
+#endif
+#if defined(LIBVIDSCRAMBLE_SSE41)
+    const __m128i low_byte_128 = _mm_set1_epi16(0xFF);
+    for(; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + i));
+        __m128i a_lo = _mm_cvtepu8_epi16(a);
+        __m128i a_hi = _mm_cvtepu8_epi16(_mm_srli_si128(a, 8));
+        __m128i b_lo = _mm_cvtepu8_epi16(b);
+        __m128i b_hi = _mm_cvtepu8_epi16(_mm_srli_si128(b, 8));
+
+        __m128i s_lo = half_round_even(_mm_add_epi16(a_lo, b_lo));
+        __m128i s_hi = half_round_even(_mm_add_epi16(a_hi, b_hi));
+        __m128i d_lo = _mm_and_si128(half_round_even(_mm_sub_epi16(a_lo, b_lo)), low_byte_128);
+        __m128i d_hi = _mm_and_si128(half_round_even(_mm_sub_epi16(a_hi, b_hi)), low_byte_128);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(sum + i), _mm_packus_epi16(s_lo, s_hi));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(diff + i), _mm_packus_epi16(d_lo, d_hi));
+    }
+#endif
+    for(; i < n; ++i) {
+        sum[i] = (uchar)half_round_even((int16_t)(row0[i] + row1[i]));
+        // negative differences wrap around to the upper half of the uint8 range
+        diff[i] = (uchar)(half_round_even((int16_t)(row0[i] - row1[i])) & 0xFF);
+    }
+}
+
+void row_mix_inverse(const uchar *sum, const uchar *diff, uchar *row0, uchar *row1, size_t n) {
+    size_t i = 0;
+#if defined(LIBVIDSCRAMBLE_AVX2)
+    for(; i + 32 <= n; i += 32) {
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sum + i));
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(diff + i));
+        __m256i s_lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(s));
+        __m256i s_hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(s, 1));
+        __m256i d_lo = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(d));
+        __m256i d_hi = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(d, 1));
+
+        __m256i a = _mm256_packus_epi16(_mm256_add_epi16(s_lo, d_lo), _mm256_add_epi16(s_hi, d_hi));
+        __m256i b = _mm256_packus_epi16(_mm256_sub_epi16(s_lo, d_lo), _mm256_sub_epi16(s_hi, d_hi));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(row0 + i), _mm256_permute4x64_epi64(a, 0xD8));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(row1 + i), _mm256_permute4x64_epi64(b, 0xD8));
+    }
+#endif
+#if defined(LIBVIDSCRAMBLE_SSE41)
+    for(; i + 16 <= n; i += 16) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sum + i));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(diff + i));
+        __m128i s_lo = _mm_cvtepu8_epi16(s);
+        __m128i s_hi = _mm_cvtepu8_epi16(_mm_srli_si128(s, 8));
+        __m128i d_lo = _mm_cvtepi8_epi16(d);
+        __m128i d_hi = _mm_cvtepi8_epi16(_mm_srli_si128(d, 8));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(row0 + i),
+                         _mm_packus_epi16(_mm_add_epi16(s_lo, d_lo), _mm_add_epi16(s_hi, d_hi)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(row1 + i),
+                         _mm_packus_epi16(_mm_sub_epi16(s_lo, d_lo), _mm_sub_epi16(s_hi, d_hi)));
+    }
+#endif
+    for(; i < n; ++i) {
+        const int d = (int8_t)diff[i];
+        row0[i] = cv::saturate_cast<uchar>(sum[i] + d);
+        row1[i] = cv::saturate_cast<uchar>(sum[i] - d);
+    }
+}
+
+// rows of the permuted row groups that receive the sum and the difference of row pair i
+static inline std::pair<int, int> row_mix_targets(int i, int num_rows_per_group, const std::vector<int> &perm,
+                                                  int row_group_size) {
+    const int row_sum_group_ind = i / row_group_size;
+    const int row_sum_group_offset = i % row_group_size;
+    const int row_diff_group_ind = (i + num_rows_per_group) / row_group_size;
+    const int row_diff_group_offset = (i + num_rows_per_group) % row_group_size;
+
+    return {row_group_size * perm[row_sum_group_ind] + row_sum_group_offset,
+            row_group_size * perm[row_diff_group_ind] + row_diff_group_offset};
+}
+
+void row_mix(const cv::Mat &src, cv::Mat &dst, const std::vector<int> &perm, int row_group_size,
+             bool inverse, ThreadPool &pool) {
+    CV_Assert(src.type() == dst.type() && src.size() == dst.size() && src.depth() == CV_8U);
+    CV_Assert(src.data != dst.data);
+
+    const int num_rows_per_group = src.rows / 2;
+    const size_t row_elements = src.cols * src.channels();
+
+    auto mix_rows = [&](int row_begin, int row_end) {
+        for(auto i = row_begin; i < row_end; ++i) {
+            auto targets = row_mix_targets(i, num_rows_per_group, perm, row_group_size);
+            if (!inverse) {
+                row_mix_forward(src.ptr(i), src.ptr(i + num_rows_per_group),
+                                dst.ptr(targets.first), dst.ptr(targets.second), row_elements);
+            } else {
+                row_mix_inverse(src.ptr(targets.first), src.ptr(targets.second),
+                                dst.ptr(i), dst.ptr(i + num_rows_per_group), row_elements);
+            }
+        }
+    };
+
+    if (use_parallel(dst)) {
+        pool.parallel_for(0, num_rows_per_group, mix_rows);
+    } else {
+        mix_rows(0, num_rows_per_group);
+    }
+}
+
+void row_mix(const FrameView &src, cv::Mat &dst, const std::vector<int> &perm, int row_group_size,
+             bool inverse, ThreadPool &pool) {
+    if (src.is_plain()) {
+        row_mix(src.base(), dst, perm, row_group_size, inverse, pool);
+        return;
+    }
+    CV_Assert(src.type() == dst.type() && src.size() == dst.size() && src.base().depth() == CV_8U);
+    CV_Assert(src.base().data != dst.data);
+
+    const int num_rows_per_group = src.rows() / 2;
+    const size_t row_elements = src.cols() * dst.channels();
+    const int num_blocks = (num_rows_per_group + row_mix_view_block_size - 1) / row_mix_view_block_size;
+
+    // copies view rows row_of(0), row_of(1), ... to consecutive rows of block, one read per run of adjacent rows
+    auto gather_rows = [&](int num_rows, const auto &row_of, cv::Mat &block) {
+        for(auto k = 0; k < num_rows;) {
+            auto run = 1;
+            while(k + run < num_rows && row_of(k + run) == row_of(k) + run) {
+                ++run;
+            }
+            cv::Mat block_rows = block.rowRange(k, k + run);
+            src.read(cv::Rect(0, row_of(k), src.cols(), run), block_rows, pool);
+            k += run;
+        }
+    };
+
+    auto mix_blocks = [&](int block_begin, int block_end) {
+        // per thread scratch, reused across frames
+        thread_local cv::Mat block_a, block_b;
+        block_a.create(row_mix_view_block_size, src.cols(), src.type());
+        block_b.create(row_mix_view_block_size, src.cols(), src.type());
+        for(auto b = block_begin; b < block_end; ++b) {
+            const int i0 = b * row_mix_view_block_size;
+            const int num_rows = std::min(row_mix_view_block_size, num_rows_per_group - i0);
+
+            if (!inverse) {
+                gather_rows(num_rows, [&](int k) { return i0 + k; }, block_a);
+                gather_rows(num_rows, [&](int k) { return i0 + k + num_rows_per_group; }, block_b);
+            } else {
+                gather_rows(num_rows, [&](int k) {
+                    return row_mix_targets(i0 + k, num_rows_per_group, perm, row_group_size).first;
+                }, block_a);
+                gather_rows(num_rows, [&](int k) {
+                    return row_mix_targets(i0 + k, num_rows_per_group, perm, row_group_size).second;
+                }, block_b);
+            }
+
+            for(auto k = 0; k < num_rows; ++k) {
+                const int i = i0 + k;
+                if (!inverse) {
+                    auto targets = row_mix_targets(i, num_rows_per_group, perm, row_group_size);
+                    row_mix_forward(block_a.ptr(k), block_b.ptr(k),
+                                    dst.ptr(targets.first), dst.ptr(targets.second), row_elements);
+                } else {
+                    row_mix_inverse(block_a.ptr(k), block_b.ptr(k),
+                                    dst.ptr(i), dst.ptr(i + num_rows_per_group), row_elements);
+                }
+            }
+        }
+    };
+
+    if (use_parallel(dst)) {
+        pool.parallel_for(0, num_blocks, mix_blocks);
+    } else {
+        mix_blocks(0, num_blocks);
+    }
+}
+
+
+template <typename Pixel>
+static void transpose_block(const cv::Mat &src, cv::Mat &dst, int y_begin, int y_end, int x_begin, int x_end) {
+    for(auto y = y_begin; y < y_end; ++y) {
+        const Pixel *src_row = src.ptr<Pixel>(y);
+        for(auto x = x_begin; x < x_end; ++x) {
+            dst.ptr<Pixel>(x)[y] = src_row[x];
+        }
+    }
+}
+
+#if defined(LIBVIDSCRAMBLE_SSE41)
+// 16x16 bytes; four rounds of interleaving row i with row i + 8 rotate the (row, column) index bits into place
+static inline void transpose_16x16_8uc1(const uchar *src, size_t src_step, uchar *dst, size_t dst_step) {
+    __m128i a[16], b[16];
+    for(auto i = 0; i < 16; ++i) {
+        a[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * src_step));
+    }
+    for(auto round = 0; round < 2; ++round) {
+        for(auto i = 0; i < 8; ++i) {
+            b[2 * i] = _mm_unpacklo_epi8(a[i], a[i + 8]);
+            b[2 * i + 1] = _mm_unpackhi_epi8(a[i], a[i + 8]);
+        }
+        for(auto i = 0; i < 8; ++i) {
+            a[2 * i] = _mm_unpacklo_epi8(b[i], b[i + 8]);
+            a[2 * i + 1] = _mm_unpackhi_epi8(b[i], b[i + 8]);
+        }
+    }
+    for(auto i = 0; i < 16; ++i) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * dst_step), a[i]);
+    }
+}
+
+// 4x4 packed BGR pixels: widen each pixel to 32 bits, transpose as 4x4 epi32 and pack back to 12 byte rows.
+// Loads and stores touch exactly 12 bytes so the kernel never reads or writes past the tile.
+static inline void transpose_4x4_8uc3(const uchar *src, size_t src_step, uchar *dst, size_t dst_step) {
+    const __m128i widen = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i narrow = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    __m128i a[4];
+    for(auto i = 0; i < 4; ++i) {
+        const uchar *p = src + i * src_step;
+        int32_t tail;
+        std::memcpy(&tail, p + 8, sizeof(tail));
+        __m128i row = _mm_insert_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), tail, 2);
+        a[i] = _mm_shuffle_epi8(row, widen);
+    }
+
+    __m128i t0 = _mm_unpacklo_epi32(a[0], a[1]);
+    __m128i t1 = _mm_unpacklo_epi32(a[2], a[3]);
+    __m128i t2 = _mm_unpackhi_epi32(a[0], a[1]);
+    __m128i t3 = _mm_unpackhi_epi32(a[2], a[3]);
+    a[0] = _mm_unpacklo_epi64(t0, t1);
+    a[1] = _mm_unpackhi_epi64(t0, t1);
+    a[2] = _mm_unpacklo_epi64(t2, t3);
+    a[3] = _mm_unpackhi_epi64(t2, t3);
+
+    for(auto i = 0; i < 4; ++i) {
+        uchar *p = dst + i * dst_step;
+        __m128i row = _mm_shuffle_epi8(a[i], narrow);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(p), row);
+        int32_t tail = _mm_extract_epi32(row, 2);
+        std::memcpy(p + 8, &tail, sizeof(tail));
+    }
+}
+
+// whole micro blocks of the tile go through the kernel, the ragged right and bottom edges through the scalar loop
+template <typename Pixel, int block_size, typename MicroKernel>
+static void transpose_block_simd(const cv::Mat &src, cv::Mat &dst, int y_begin, int y_end, int x_begin, int x_end,
+                                 MicroKernel kernel) {
+    const int y_simd_end = y_begin + (y_end - y_begin) / block_size * block_size;
+    const int x_simd_end = x_begin + (x_end - x_begin) / block_size * block_size;
+    for(auto y = y_begin; y < y_simd_end; y += block_size) {
+        for(auto x = x_begin; x < x_simd_end; x += block_size) {
+            kernel(src.ptr(y) + x * sizeof(Pixel), src.step, dst.ptr(x) + y * sizeof(Pixel), dst.step);
+        }
+    }
+    transpose_block<Pixel>(src, dst, y_begin, y_simd_end, x_simd_end, x_end);
+    transpose_block<Pixel>(src, dst, y_simd_end, y_end, x_begin, x_end);
+}
+#endif
+
+template <typename Pixel>
+static void transpose_tile(const cv::Mat &src, cv::Mat &dst, int y_begin, int y_end, int x_begin, int x_end) {
+#if defined(LIBVIDSCRAMBLE_SSE41)
+    if constexpr (sizeof(Pixel) == 1) {
+        transpose_block_simd<Pixel, 16>(src, dst, y_begin, y_end, x_begin, x_end, transpose_16x16_8uc1);
+    } else {
+        transpose_block_simd<Pixel, 4>(src, dst, y_begin, y_end, x_begin, x_end, transpose_4x4_8uc3);
+    }
+#else
+    transpose_block<Pixel>(src, dst, y_begin, y_end, x_begin, x_end);
+#endif
+}
+
+template <typename Pixel>
+static void transpose_tiled(const cv::Mat &src, cv::Mat &dst, ThreadPool &pool) {
+    // each task owns a band of destination rows (source columns) and walks down the source tile by tile
+    auto transpose_tile_columns = [&](int tile_begin, int tile_end) {
+        for(auto t = tile_begin; t < tile_end; ++t) {
+            const int x_begin = t * transpose_tile_size;
+            const int x_end = std::min(x_begin + transpose_tile_size, src.cols);
+            for(auto y_begin = 0; y_begin < src.rows; y_begin += transpose_tile_size) {
+                const int y_end = std::min(y_begin + transpose_tile_size, src.rows);
+                transpose_tile<Pixel>(src, dst, y_begin, y_end, x_begin, x_end);
+            }
+        }
+    };
+
+    const int num_tile_columns = (src.cols + transpose_tile_size - 1) / transpose_tile_size;
+    if (use_parallel(src)) {
+        pool.parallel_for(0, num_tile_columns, transpose_tile_columns);
+    } else {
+        transpose_tile_columns(0, num_tile_columns);
+    }
+}
+
+void transpose_into(const cv::Mat &src, cv::Mat &dst, ThreadPool &pool) {
+    CV_Assert(src.dims == 2 && &src != &dst);
+
+    dst.create(src.cols, src.rows, src.type());
+    CV_Assert(src.data != dst.data);
+
+    switch(src.type()) {
+        case CV_8UC1:
+            transpose_tiled<uchar>(src, dst, pool);
+            break;
+        case CV_8UC3:
+            transpose_tiled<cv::Vec3b>(src, dst, pool);
+            break;
+        default:
+            cv::transpose(src, dst);
+            break;
+    }
+}
@@ -0,0 +1,196 @@
+#include "thread_pool.h"
+#include <algorithm>
+#include <exception>
+
+
+// pool and deque index of the calling thread when it is a worker
+static thread_local const ThreadPool *current_pool = nullptr;
+static thread_local size_t current_queue = 0;
+
+ThreadPool::ThreadPool(int num_threads) {
+    if (num_threads < 1) {
+        num_threads = std::max(1, (int)std::thread::hardware_concurrency());
+    }
+    for(auto i = 0; i < num_threads; ++i) {
+        _queues.emplace_back(std::make_unique<TaskQueue>());
+    }
+    // the calling thread is one of the threads
+    for(auto i = 1; i < num_threads; ++i) {
+        _workers.emplace_back([this, i]() { _worker_loop(i); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(_sleep_mutex);
+        _stop = true;
+    }
+    _sleep_cv.notify_all();
+    for(auto &worker : _workers) {
+        worker.join();
+    }
+}
+
+int ThreadPool::get_num_threads() const {
+    return (int)_workers.size() + 1;
+}
+
+size_t ThreadPool::_own_queue() const {
+    return current_pool == this ? current_queue : 0;
+}
+
+struct ThreadPool::Job {
+    explicit Job(ChunkFunctionRef fn, int num_chunks) : fn(fn), remaining(num_chunks) {}
+
+    ChunkFunctionRef fn;
+    // chunks still running; the first exception is kept under error_mutex
+    std::atomic<int> remaining;
+    std::mutex error_mutex;
+    std::exception_ptr error;
+};
+
+void ThreadPool::TaskQueue::push_back(const Task &task) {
+    if (size == ring.size()) {
+        std::vector<Task> grown(std::max<size_t>(16, 2 * ring.size()));
+        for(size_t i = 0; i < size; ++i) {
+            grown[i] = ring[(head + i) % ring.size()];
+        }
+        ring.swap(grown);
+        head = 0;
+    }
+    ring[(head + size) % ring.size()] = task;
+    ++size;
+}
+
+ThreadPool::Task ThreadPool::TaskQueue::pop_back() {
+    --size;
+    return ring[(head + size) % ring.size()];
+}
+
+ThreadPool::Task ThreadPool::TaskQueue::pop_front() {
+    auto task = ring[head];
+    head = (head + 1) % ring.size();
+    --size;
+    return task;
+}
+
+bool ThreadPool::_pop_task(size_t queue, Task &task) {
+    if (_num_queued == 0) {
+        return false;
+    }
+    {
+        auto &own = *_queues[queue];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (own.size != 0) {
+            task = own.pop_back();
+            --_num_queued;
+            return true;
+        }
+    }
+    for(size_t i = 1; i < _queues.size(); ++i) {
+        auto &victim = *_queues[(queue + i) % _queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.size != 0) {
+            task = victim.pop_front();
+            --_num_queued;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::_run_task(const Task &task) {
+    auto &job = *task.job;
+    try {
+        job.fn(task.begin, task.end);
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(job.error_mutex);
+        if (!job.error) {
+            job.error = std::current_exception();
+        }
+    }
+    // the job may be gone once remaining hits zero, so nothing of it is used after the decrement
+    if (--job.remaining == 0) {
+        std::lock_guard<std::mutex> lock(_sleep_mutex);
+        _sleep_cv.notify_all();
+    }
+}
+
+void ThreadPool::_worker_loop(size_t queue) {
+    current_pool = this;
+    current_queue = queue;
+    while(true) {
+        Task task;
+        if (_pop_task(queue, task)) {
+            _run_task(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(_sleep_mutex);
+        _sleep_cv.wait(lock, [this]() { return _stop || _num_queued > 0; });
+        if (_stop && _num_queued == 0) {
+            return;
+        }
+    }
+}
+
+void ThreadPool::parallel_for(int begin, int end, ChunkFunctionRef fn, int min_chunk) {
+    if (end <= begin) {
+        return;
+    }
+
+    const int num_items = end - begin;
+    // a few chunks per thread evens out chunks of uneven cost
+    const int max_chunks = 4 * get_num_threads();
+    const int num_chunks = std::min(max_chunks, std::max(1, num_items / std::max(1, min_chunk)));
+    if (num_chunks == 1 || _workers.empty()) {
+        fn(begin, end);
+        return;
+    }
+
+    const int chunk_size = num_items / num_chunks;
+    const int chunk_remainder = num_items % num_chunks;
+    auto chunk_begin = [&](int c) {
+        return begin + c * chunk_size + std::min(c, chunk_remainder);
+    };
+
+    Job job(fn, num_chunks);
+
+    // the owner pops from the back, so pushing the last chunks first leaves it working front to back while
+    // thieves take the far end
+    const size_t queue = _own_queue();
+    {
+        auto &own = *_queues[queue];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        for(auto c = num_chunks - 1; c >= 1; --c) {
+            own.push_back({&job, chunk_begin(c), chunk_begin(c + 1)});
+        }
+        _num_queued += num_chunks - 1;
+    }
+    // taking the sleep mutex orders the count update before any sleeper re-checks it
+    {
+        std::lock_guard<std::mutex> lock(_sleep_mutex);
+    }
+    _sleep_cv.notify_all();
+
+    _run_task({&job, chunk_begin(0), chunk_begin(1)});
+
+    // help with queued work (possibly from other callers) until our chunks are done
+    while(job.remaining > 0) {
+        Task task;
+        if (_pop_task(queue, task)) {
+            _run_task(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(_sleep_mutex);
+        _sleep_cv.wait(lock, [&]() { return job.remaining == 0 || _num_queued > 0; });
+    }
+
+    if (job.error) {
+        std::rethrow_exception(job.error);
+    }
+}
+
+ThreadPool &get_default_thread_pool() {
+    static ThreadPool pool;
+    return pool;
+}
@@ -48,11 +48,7 @@ OpenCVMatDataInfo get_opencv_mat_data_info(int type) {
     return info;
 }
 
-cv::Mat translate_wrap(const cv::Mat &input, int sx, int sy) {
-    // Get image dimensions.
-    int w = input.size().width;
-    int h = input.size().height;
-
+cv::Point normalize_wrap_offset(int sx, int sy, int w, int h) {
     if (sx < 0) {
         sx = (-sx / w + 1) * w + sx;
     }
@@ -60,8 +56,17 @@ cv::Mat translate_wrap(const cv::Mat &input, int sx, int sy) {
         sy = (-sy / h + 1) * h + sy;
     }
 
-    sx = sx % w;
-    sy = sy % h;
+    return {sx % w, sy % h};
+}
+
+cv::Mat translate_wrap(const cv::Mat &input, int sx, int sy) {
+    // Get image dimensions.
+    int w = input.size().width;
+    int h = input.size().height;
+
+    auto offset = normalize_wrap_offset(sx, sy, w, h);
+    sx = offset.x;
+    sy = offset.y;
 
     if (sx == 0 && sy == 0){
         return input;
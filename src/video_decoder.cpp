@@ -1,11 +1,89 @@
 #include "pipeline_parser.h"
+#include "data_region_tracker.h"
+#include "spsc_queue.h"
 #include <argparse/argparse.hpp>
+#include <fstream>
+#include <functional>
+
+// The decoder runs as a chain of stages connected by bounded lock-free queues:
+//   read (decode a bgr frame) -> detect (track the data region, rebuild the pipeline on a new detection)
+//   -> inverse (any number of workers) -> write (encode, raw frames or a window, on the main thread).
+// The detect stage hands frame i to worker i % n and the write stage takes them back in the same order, so every queue
+// has a single producer and a single consumer and the output keeps the input order.
+
+using stage_clock = std::chrono::steady_clock;
+
+enum FrameStage {
+    stage_read,
+    stage_detect,
+    stage_inverse,
+    stage_write,
+    num_frame_stages
+};
+
+const std::array<const char*, num_frame_stages> frame_stage_names{"read", "detect", "inverse", "write"};
+
+// one frame on its way through the stages
+struct FrameJob {
+    cv::Mat frame;
+    cv::Mat recovered;
+    std::shared_ptr<const VideoScramblePipeline> pipeline;
+    ImageDataTransform tf;
+    size_t timestamp = 0;
+    stage_clock::time_point read_begin;
+    // end of each stage
+    std::array<stage_clock::time_point, num_frame_stages> stage_end;
+};
+
+struct LatencyStats {
+    double total_ms = 0.0;
+    double max_ms = 0.0;
+
+    void add(stage_clock::time_point begin, stage_clock::time_point end) {
+        const double ms = std::chrono::duration<double, std::milli>(end - begin).count();
+        total_ms += ms;
+        max_ms = std::max(max_ms, ms);
+    }
+};
+
+// runs a stage body; an exception stops the whole chain
+template<typename Fn>
+static void run_stage(const char *name, const std::function<void()> &stop_all, Fn &&fn) {
+    try {
+        fn();
+    } catch (const std::exception &e) {
+        std::cerr << format("{} stage failed: {}\n", name, e.what());
+        stop_all();
+    }
+}
 
 
 int main(int argc, char *argv[]) {
     argparse::ArgumentParser program("video_decoder");
 
     program.add_argument("video_filename");
+    program.add_argument("-o", "--output")
+            .help("write the recovered video to this file instead of showing it")
+            .default_value(std::string(""));
+    program.add_argument("--raw")
+            .help("write raw bgr24 frames to the output file instead of encoding them")
+            .default_value(false)
+            .implicit_value(true);
+    program.add_argument("--fourcc")
+            .help("codec of the output video")
+            .default_value(std::string("mp4v"));
+    program.add_argument("--headless")
+            .help("recover the frames without showing or writing them (implied by --output)")
+            .default_value(false)
+            .implicit_value(true);
+    program.add_argument("-j", "--workers")
+            .help("threads of the inverse stage, 0 for the number of hardware threads")
+            .default_value(0)
+            .scan<'i', int>();
+    program.add_argument("--queue-size")
+            .help("frames each queue between two stages holds")
+            .default_value(8)
+            .scan<'i', int>();
 
     try {
         program.parse_args(argc, argv);
@@ -15,71 +93,242 @@ int main(int argc, char *argv[]) {
     }
 
     auto video_filename = program.get<std::string>("video_filename");
+    auto output_filename = program.get<std::string>("--output");
+    auto raw_output = program.get<bool>("--raw");
+    auto fourcc = program.get<std::string>("--fourcc");
+    auto headless = program.get<bool>("--headless") || !output_filename.empty();
+    auto num_workers = program.get<int>("--workers");
+    auto queue_size = program.get<int>("--queue-size");
+    if (num_workers < 1) {
+        num_workers = std::max(1, (int)std::thread::hardware_concurrency());
+    }
+    if (queue_size < 1) {
+        std::cerr << format("invalid queue size {}\n", queue_size);
+        return 1;
+    }
+    if (fourcc.size() != 4) {
+        std::cerr << format("invalid fourcc \"{}\"\n", fourcc);
+        return 1;
+    }
 
     cv::VideoCapture cap(video_filename);
 
     if(!cap.isOpened()) {
         std::cerr << format("error opening video file \"{}\"", video_filename);
+        return 1;
     }
+    const double video_fps = cap.get(cv::CAP_PROP_FPS) > 0.0 ? cap.get(cv::CAP_PROP_FPS) : 30.0;
 
-    ImageDataTransform tf;
-    auto data_ex_tf_success = false;
-    int frame_id = 0;
-    std::shared_ptr<VideoScramblePipeline> pipeline;
+    SpscQueue<FrameJob> read_queue((size_t)queue_size);
+    std::vector<std::unique_ptr<SpscQueue<FrameJob>>> inverse_queues, output_queues;
+    for(auto i = 0; i < num_workers; ++i) {
+        inverse_queues.emplace_back(std::make_unique<SpscQueue<FrameJob>>((size_t)queue_size));
+        output_queues.emplace_back(std::make_unique<SpscQueue<FrameJob>>((size_t)queue_size));
+    }
 
-    while(true){
+    // closing every queue makes each stage drop out of its push / pop
+    std::atomic<bool> stop{false};
+    std::function<void()> stop_all = [&]() {
+        stop = true;
+        read_queue.close();
+        for(auto i = 0; i < num_workers; ++i) {
+            inverse_queues[i]->close();
+            output_queues[i]->close();
+        }
+    };
 
-        cv::Mat frame;
-        // Capture frame-by-frame
-        cap >> frame;
+    const auto start_time = stage_clock::now();
 
-        // If the frame is empty, break immediately
-        if (frame.empty()){
-            break;
-        }
+    size_t num_read = 0;
+    std::thread reader([&]() {
+        run_stage("read", stop_all, [&]() {
+            while(!stop) {
+                FrameJob job;
+                job.read_begin = stage_clock::now();
+                cap >> job.frame;
+                if (job.frame.empty()) {
+                    break;
+                }
+                job.stage_end[stage_read] = stage_clock::now();
+                ++num_read;
+                if (!read_queue.push(std::move(job))) {
+                    break;
+                }
+            }
+        });
+        read_queue.close();
+    });
 
-        cv::cvtColor(frame, frame, cv::COLOR_BGR2RGB);
-
-
-        if (!data_ex_tf_success) {
-            data_ex_tf_success = VideoScramblePipeline::get_data_extraction_transform(frame, tf);
-            if (!data_ex_tf_success) {
-                std::cout << format("failed to extract data transformation information in frame {}\n", frame_id++);
-                continue;
-            } else {
-                // decode data
-                auto data = VideoScramblePipeline::extract_data(frame, tf);
-                std::cout << format("decoded data from the video: {}", data);
-                auto data_json = nlohmann::json::parse(data);
-                // build pipeline
-                pipeline = build_pipeline_from_json(data);
-                // create a duumy image to fit the pipeline
-                cv::Mat dummy(data_json["state"]["input_height"].get<int>(), data_json["state"]["input_width"].get<int>(), CV_8UC3);
-                pipeline->fit(dummy);
-                // sync state
-                pipeline->sync_state(data_json["state"]);
+    // detection runs again only when the tracked data region stops matching (e.g. after a resolution switch)
+    DataRegionTracker tracker;
+    // the data band is read in the channel order OpenCV decodes to, so frames go through without color conversions
+    tracker.set_channel_order(ChannelOrder::bgr);
+    size_t num_lost = 0;
+    std::thread detector([&]() {
+        run_stage("detect", stop_all, [&]() {
+            std::shared_ptr<const VideoScramblePipeline> pipeline;
+            size_t timestamp = 0;
+            size_t frame_id = 0, seq = 0;
+            FrameJob job;
+            while(read_queue.pop(job)) {
+                auto status = tracker.update(job.frame);
+                if (status == DataRegionTracker::Status::detected) {
+                    try {
+                        // decode data
+                        PipelineMetadata metadata;
+                        VideoScramblePipeline::extract_metadata(job.frame, tracker.get_transform(), metadata);
+                        std::cout << format("decoded data from the video: {}\n",
+                                            pipeline_metadata_to_json(metadata).dump());
+                        // build pipeline
+                        auto new_pipeline = build_pipeline_from_metadata(metadata);
+                        // workers split the frames, so each frame runs on a single thread
+                        if (num_workers > 1) {
+                            new_pipeline->set_num_threads(1);
+                        }
+                        // create a dummy image to fit the pipeline
+                        cv::Mat dummy((int)metadata.state.input_height, (int)metadata.state.input_width, CV_8UC3);
+                        new_pipeline->fit(dummy);
+                        pipeline = new_pipeline;
+                        timestamp = metadata.state.timestamp;
+                    } catch (const std::exception &e) {
+                        std::cerr << format("failed to decode the pipeline in frame {}: {}\n", frame_id, e.what());
+                        tracker.reset();
+                        status = DataRegionTracker::Status::lost;
+                    }
+                }
+                if (status == DataRegionTracker::Status::lost) {
+                    std::cout << format("failed to extract data transformation information in frame {}\n", frame_id++);
+                    ++num_lost;
+                    continue;
+                }
+
+                job.pipeline = pipeline;
+                job.tf = tracker.get_transform();
+                job.timestamp = timestamp++;
+                job.stage_end[stage_detect] = stage_clock::now();
+                ++frame_id;
+                if (!inverse_queues[seq++ % num_workers]->push(std::move(job))) {
+                    break;
+                }
             }
+        });
+        for(auto &queue : inverse_queues) {
+            queue->close();
         }
+    });
+
+    std::vector<std::thread> workers;
+    for(auto w = 0; w < num_workers; ++w) {
+        workers.emplace_back([&, w]() {
+            run_stage("inverse", stop_all, [&]() {
+                FrameJob job;
+                while(inverse_queues[w]->pop(job)) {
+                    // apply inverse transform
+                    job.pipeline->inverse_transform_into(job.frame, job.tf, job.timestamp, job.recovered);
+                    job.frame.release();
+                    job.pipeline.reset();
+                    job.stage_end[stage_inverse] = stage_clock::now();
+                    if (!output_queues[w]->push(std::move(job))) {
+                        break;
+                    }
+                }
+            });
+            output_queues[w]->close();
+        });
+    }
 
-        // apply inverse transform
-        auto new_frame = pipeline->inverse_transform(frame, tf);
-        cv::cvtColor(new_frame, new_frame, cv::COLOR_RGB2BGR);
+    // the write stage runs here, a window has to be driven from the main thread
+    cv::VideoWriter video_writer;
+    std::ofstream raw_writer;
+    cv::Size output_size;
+    std::array<LatencyStats, num_frame_stages> stage_latency;
+    LatencyStats total_latency;
+    size_t num_written = 0;
+    run_stage("write", stop_all, [&]() {
+        FrameJob job;
+        for(size_t seq = 0; output_queues[seq % num_workers]->pop(job); ++seq) {
+            if (!output_filename.empty()) {
+                if (output_size.empty()) {
+                    output_size = job.recovered.size();
+                    if (raw_output) {
+                        raw_writer.open(output_filename, std::ios::binary);
+                        if (!raw_writer) {
+                            throw std::runtime_error{format("unable to open \"{}\"", output_filename)};
+                        }
+                        std::cout << format("writing raw bgr24 frames of {}x{} to \"{}\"\n", output_size.width,
+                                            output_size.height, output_filename);
+                    } else if (!video_writer.open(output_filename,
+                                                  cv::VideoWriter::fourcc(fourcc[0], fourcc[1], fourcc[2], fourcc[3]),
+                                                  video_fps, output_size)) {
+                        throw std::runtime_error{format("unable to open \"{}\" for writing", output_filename)};
+                    }
+                }
+                // a stream has one frame size; frames of a pipeline that changed mid-video are scaled to it
+                if (job.recovered.size() != output_size) {
+                    cv::resize(job.recovered, job.recovered, output_size);
+                }
+                if (raw_output) {
+                    for(auto r = 0; r < job.recovered.rows; ++r) {
+                        raw_writer.write(job.recovered.ptr<char>(r), (std::streamsize)(job.recovered.cols * 3));
+                    }
+                } else {
+                    video_writer.write(job.recovered);
+                }
+            } else if (!headless) {
+                // Display the resulting frame
+                imshow("video frame", job.recovered);
 
-        // Display the resulting frame
-        imshow( format("video frame", frame_id), new_frame);
+                // Press  ESC on keyboard to exit
+                auto c = (char)cv::waitKey(1);
+                if(c == 27){
+                    stop_all();
+                    break;
+                }
+            }
+            job.stage_end[stage_write] = stage_clock::now();
+            ++num_written;
 
-        // Press  ESC on keyboard to exit
-        auto c = (char)cv::waitKey(10);
-        if(c == 27){
-            break;
+            auto begin = job.read_begin;
+            for(auto s = 0; s < num_frame_stages; ++s) {
+                stage_latency[s].add(begin, job.stage_end[s]);
+                begin = job.stage_end[s];
+            }
+            total_latency.add(job.read_begin, job.stage_end[stage_write]);
         }
+    });
+    // a failed write leaves the other stages blocked on full queues
+    stop_all();
 
-        ++frame_id;
+    reader.join();
+    detector.join();
+    for(auto &worker : workers) {
+        worker.join();
     }
+    const double seconds = std::chrono::duration<double>(stage_clock::now() - start_time).count();
 
+    video_writer.release();
+    raw_writer.close();
     cap.release();
-    cv::destroyAllWindows();
+    if (!headless) {
+        cv::destroyAllWindows();
+    }
 
+    std::cout << format("recovered {} of {} frames ({} without a data region transform) in {:.2f} s, {:.1f} fps, "
+                        "{} inverse workers\n", num_written, num_read, num_lost, seconds,
+                        seconds > 0.0 ? num_written / seconds : 0.0, num_workers);
+    if (num_written > 0) {
+        // the latency of a stage includes the time the frame waited in the queue in front of it
+        std::cout << "stage latency, mean / max ms:";
+        for(auto s = 0; s < num_frame_stages; ++s) {
+            std::cout << format(" {} {:.2f} / {:.2f},", frame_stage_names[s], stage_latency[s].total_ms / num_written,
+                                stage_latency[s].max_ms);
+        }
+        std::cout << format(" end to end {:.2f} / {:.2f}\n", total_latency.total_ms / num_written,
+                            total_latency.max_ms);
+    }
+    const auto &stats = tracker.get_stats();
+    std::cout << format("{} frames, {} verified, {} without data, {} detections ({} failed)\n", stats.num_frames,
+                        stats.num_verified, stats.num_no_data, stats.num_detections, stats.num_failed_detections);
 
     return 0;
 }
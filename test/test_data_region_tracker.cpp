@@ -0,0 +1,136 @@
+#include "pipeline_parser.h"
+#include "data_region_tracker.h"
+#include <cmath>
+
+// Walks a DataRegionTracker through the transitions of a video: a detection on the first frame, verified data frames
+// and frames without a data band (all white) after it, a new resolution, a frame of the same size whose data band
+// moved (the verification fails and a full detection runs), and misread cells of the bottom left marker up to the
+// tolerance of the verification and one past it.
+
+// every second frame carries a data band
+static std::string pipeline_spec(int block_size) {
+    return format(R"({{
+        "data_embed_block_size": {},
+        "data_embed_num_rows": 4,
+        "data_embed_interval": 2,
+        "steps": [
+            {{"name": "ImageShift", "sx": 1, "sy": -1}},
+            {{"name": "RowShuffle", "row_group_size": 8, "random_seed": 42}},
+            {{"name": "ImageTranspose"}},
+            {{"name": "RowShuffle", "row_group_size": 8, "random_seed": 300}},
+            {{"name": "ImageTranspose"}}
+        ]
+    }})", block_size);
+}
+
+struct Video {
+    cv::Mat img;
+    std::shared_ptr<VideoScramblePipeline> pipeline;
+};
+
+static Video make_video(const cv::Size &size, int block_size) {
+    Video ret;
+    ret.img.create(size, CV_8UC3);
+    cv::randu(ret.img, cv::Scalar::all(0), cv::Scalar::all(256));
+    ret.pipeline = build_pipeline_from_json(pipeline_spec(block_size));
+    ret.pipeline->fit(ret.img);
+    return ret;
+}
+
+// inverts the given cells of the 8x8 grid of the bottom left marker around the points the tracker samples
+static void flip_marker_cells(cv::Mat &frame, const ImageDataTransform &tf, const std::vector<cv::Point> &cells) {
+    const float block_size_x = (tf.data_region_x - tf.image_region_x) / 5;
+    const float block_size_y = tf.data_region_height / tf.num_data_rows;
+    const float x_begin = tf.image_region_x + block_size_x / 2;
+    const float cell_w = (tf.data_region_x - block_size_x / 2 - x_begin) / 8;
+    const float cell_h = 4 * block_size_y / 8;
+    for(const auto &cell : cells) {
+        const int x = (int)std::lround(x_begin + (cell.x + 0.5f) * cell_w);
+        const int y = (int)std::lround(tf.data_region_y + (cell.y + 0.5f) * cell_h);
+        cv::Mat patch = frame(cv::Rect(x - 1, y - 1, 3, 3));
+        cv::bitwise_not(patch, patch);
+    }
+}
+
+int main() {
+    int num_failures = 0;
+    auto expect = [&](bool ok, const std::string &message) {
+        if (!ok) {
+            std::cerr << message << "\n";
+            ++num_failures;
+        }
+    };
+    using Status = DataRegionTracker::Status;
+
+    DataRegionTracker tracker;
+    auto video = make_video(cv::Size(1280, 720), 8);
+
+    // a detection, then verified data frames and white bands
+    for(size_t t = 0; t < 6; ++t) {
+        const auto frame = video.pipeline->transform(video.img, t);
+        const auto status = tracker.update(frame);
+        const auto expected = t == 0 ? Status::detected : Status::tracked;
+        expect(status == expected, format("frame {}: status {} instead of {}", t, (int)status, (int)expected));
+        if (t % 2 == 0 && tracker.has_transform()) {
+            expect(cv::norm(video.pipeline->inverse_transform(frame, tracker.get_transform(), t), video.img,
+                            cv::NORM_INF) == 0, format("frame {}: the transform does not restore the frame", t));
+        }
+    }
+    auto stats = tracker.get_stats();
+    expect(stats.num_frames == 6 && stats.num_detections == 1 && stats.num_verified == 2 && stats.num_no_data == 3,
+           format("after 6 frames: {} detections, {} verified, {} without data", stats.num_detections,
+                  stats.num_verified, stats.num_no_data));
+
+    // a new resolution is detected without verifying the old transform
+    auto video_1080p = make_video(cv::Size(1920, 1080), 8);
+    expect(tracker.update(video_1080p.pipeline->transform(video_1080p.img, 0)) == Status::detected,
+           "the 1080p frame is not detected");
+    expect(tracker.update(video_1080p.pipeline->transform(video_1080p.img, 2)) == Status::tracked,
+           "the second 1080p frame is not tracked");
+
+    // back to the first video, then one of the same frame size with blocks twice as large, so its band starts higher:
+    // the verification fails and the detection finds the new band
+    expect(tracker.update(video.pipeline->transform(video.img, 0)) == Status::detected,
+           "the 720p frame is not detected again");
+    auto video_moved = make_video(cv::Size(1240, 680), 16);
+    const auto moved_frame = video_moved.pipeline->transform(video_moved.img, 0);
+    expect(moved_frame.size() == video.pipeline->transform(video.img, 0).size(),
+           "the moved band changes the frame size");
+    const auto detections_before = tracker.get_stats().num_detections;
+    expect(tracker.update(moved_frame) == Status::detected, "the moved band is not detected");
+    expect(tracker.get_stats().num_detections == detections_before + 1, "the moved band ran no detection");
+    if (tracker.has_transform()) {
+        expect(cv::norm(video_moved.pipeline->inverse_transform(moved_frame, tracker.get_transform(), 0),
+                        video_moved.img, cv::NORM_INF) == 0,
+               "the transform of the moved band does not restore the frame");
+    }
+
+    // misread cells on the edge of the marker grid: up to 6 keep the transform, 7 force a detection
+    expect(tracker.update(video.pipeline->transform(video.img, 0)) == Status::detected,
+           "the 720p frame is not detected again");
+    const auto tf = tracker.get_transform();
+    const std::vector<cv::Point> edge_cells{{0, 0}, {1, 0}, {2, 0}, {3, 0}, {4, 0}, {5, 0}, {6, 0}};
+    for(size_t num_cells = 1; num_cells <= edge_cells.size(); ++num_cells) {
+        auto frame = video.pipeline->transform(video.img, 2);
+        flip_marker_cells(frame, tf, {edge_cells.begin(), edge_cells.begin() + num_cells});
+        const auto detections = tracker.get_stats().num_detections;
+        const auto status = tracker.update(frame);
+        const bool verified = status == Status::tracked && tracker.get_stats().num_detections == detections;
+        expect(verified == (num_cells <= 6), format("{} misread marker cells: status {}, {} detections", num_cells,
+                                                    (int)status, tracker.get_stats().num_detections - detections));
+        if (!tracker.has_transform()) {
+            tracker.update(video.pipeline->transform(video.img, 0));
+        }
+    }
+
+    // a reset forgets the transform
+    tracker.reset();
+    expect(tracker.update(video.pipeline->transform(video.img, 2)) == Status::detected,
+           "the frame after reset() is not detected");
+
+    if (num_failures != 0) {
+        return 1;
+    }
+    std::cout << "detection, verification, white bands, resolution changes and marker errors tracked as expected\n";
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include "pipeline_parser.h"
+
+// Checks the fused gather path against the step by step path (set_permutation_fusion(false)) over a full period of
+// the ImageShift offsets, in both directions.
+const char *pipeline_specs[] = {
+    // the production spec of test_py_module.py
+    R"({
+        "data_embed_block_size": 8,
+        "data_embed_num_rows": 4,
+        "data_embed_interval": 60,
+        "steps": [
+            {"name": "ImageShift", "sx": 1, "sy": -1},
+            {"name": "RowShuffle", "row_group_size": 8, "random_seed": 42},
+            {"name": "ImageTranspose"},
+            {"name": "RowShuffle", "row_group_size": 8, "random_seed": 300},
+            {"name": "ImageTranspose"},
+            {"name": "ImageShift", "sx": -1, "sy": 1}
+        ]
+    })",
+    // shifts on transposed frames and runs split by a RowMix
+    R"({
+        "data_embed_block_size": 8,
+        "data_embed_num_rows": 4,
+        "data_embed_interval": 7,
+        "steps": [
+            {"name": "ImageTranspose"},
+            {"name": "ImageShift", "sx": 7, "sy": -3},
+            {"name": "RowShuffle", "row_group_size": 4, "random_seed": 1},
+            {"name": "ImageShift", "sx": -5, "sy": 11},
+            {"name": "ImageTranspose"},
+            {"name": "RowMix", "row_group_size": 2, "random_seed": 9},
+            {"name": "ImageTranspose"},
+            {"name": "ImageShift", "sx": 3, "sy": 3},
+            {"name": "ImageTranspose"}
+        ]
+    })"
+};
+
+int main() {
+    // every shift acts on a 512x128 or a 128x512 frame, so the offsets of all of them repeat within 512 frames
+    const int period = 512;
+    cv::Mat img(128, 512, CV_8UC3);
+    cv::randu(img, cv::Scalar::all(0), cv::Scalar::all(256));
+
+    int num_mismatches = 0;
+    for(const auto spec : pipeline_specs) {
+        auto fused = build_pipeline_from_json(spec);
+        auto reference = build_pipeline_from_json(spec);
+        reference->set_permutation_fusion(false);
+        fused->fit(img);
+        reference->fit(img);
+
+        auto state = nlohmann::json::parse(fused->to_json())["state"];
+        ImageDataTransform info;
+        info.image_region_x = 0;
+        info.image_region_y = data_embed_top_pad_rows;
+        info.image_region_width = info.original_image_region_width = state["output_width_wo_data"].get<int>();
+        info.image_region_height = info.original_image_region_height = state["output_height_wo_data"].get<int>();
+
+        for(auto t = 0; t < period; ++t) {
+            auto scrambled = fused->transform(img, t);
+            auto scrambled_reference = reference->transform(img, t);
+            if (cv::norm(scrambled, scrambled_reference, cv::NORM_INF) != 0) {
+                std::cerr << format("forward mismatch at timestamp {}\n", t);
+                ++num_mismatches;
+            }
+            // the inverse of a random frame, so the inverse gather is checked on its own
+            cv::Mat noise(scrambled.size(), CV_8UC3);
+            cv::randu(noise, cv::Scalar::all(0), cv::Scalar::all(256));
+            if (cv::norm(fused->inverse_transform(noise, info, t), reference->inverse_transform(noise, info, t),
+                         cv::NORM_INF) != 0) {
+                std::cerr << format("inverse mismatch at timestamp {}\n", t);
+                ++num_mismatches;
+            }
+        }
+    }
+
+    if (num_mismatches != 0) {
+        return 1;
+    }
+    std::cout << format("fused and step by step paths match over {} frames\n", period);
+    return 0;
+}
@@ -0,0 +1,122 @@
+#include "pipeline_parser.h"
+#include <algorithm>
+#include <cmath>
+
+// Checks the corner search of FiducialDetector::detect_data_markers against the whole frame search of detect() on
+// frames the pipeline renders at 1080p and 4K: the same three markers with the same corners, and the same
+// ImageDataTransform. The transform of the whole frame search comes from the frame placed in the top left of a
+// larger canvas, where the markers are outside the search corners and detect_data_markers falls back to detect().
+const char *pipeline_spec = R"({
+    "data_embed_block_size": 8,
+    "data_embed_num_rows": 4,
+    "data_embed_interval": 60,
+    "steps": [
+        {"name": "ImageShift", "sx": 1, "sy": -1},
+        {"name": "RowShuffle", "row_group_size": 8, "random_seed": 42},
+        {"name": "ImageTranspose"},
+        {"name": "RowShuffle", "row_group_size": 8, "random_seed": 300},
+        {"name": "ImageTranspose"},
+        {"name": "ImageShift", "sx": -1, "sy": 1}
+    ]
+})";
+
+using Markers = std::vector<std::pair<int, std::vector<cv::Point2f>>>;
+
+// the data embed markers by index
+static Markers data_markers(const std::vector<std::vector<cv::Point2f>> &marker_corners,
+                            const std::vector<int> &marker_inds) {
+    Markers ret;
+    for(size_t i = 0; i < marker_inds.size(); ++i) {
+        if (std::find(cv_aruco_marker_inds.begin(), cv_aruco_marker_inds.end(), marker_inds[i]) !=
+            cv_aruco_marker_inds.end()) {
+            ret.emplace_back(marker_inds[i], marker_corners[i]);
+        }
+    }
+    std::sort(ret.begin(), ret.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+    return ret;
+}
+
+static bool same_markers(const Markers &a, const Markers &b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for(size_t i = 0; i < a.size(); ++i) {
+        if (a[i].first != b[i].first || a[i].second.size() != b[i].second.size()) {
+            return false;
+        }
+        for(size_t j = 0; j < a[i].second.size(); ++j) {
+            const auto d = a[i].second[j] - b[i].second[j];
+            if (std::abs(d.x) > 1e-3f || std::abs(d.y) > 1e-3f) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static bool same_transform(const ImageDataTransform &a, const ImageDataTransform &b) {
+    auto close = [](float x, float y) { return std::abs(x - y) <= 1e-3f; };
+    return close(a.data_region_x, b.data_region_x) && close(a.data_region_y, b.data_region_y) &&
+           close(a.data_region_width, b.data_region_width) && close(a.data_region_height, b.data_region_height) &&
+           close(a.image_region_x, b.image_region_x) && close(a.image_region_y, b.image_region_y) &&
+           close(a.image_region_width, b.image_region_width) && close(a.image_region_height, b.image_region_height) &&
+           a.num_data_rows == b.num_data_rows && a.num_data_cols == b.num_data_cols &&
+           a.original_image_region_width == b.original_image_region_width &&
+           a.original_image_region_height == b.original_image_region_height &&
+           a.original_data_region_width == b.original_data_region_width &&
+           a.original_data_region_height == b.original_data_region_height;
+}
+
+int main() {
+    const auto &detector = get_default_fiducial_detector();
+    // a frame with a data band
+    const size_t timestamp = 120;
+
+    int num_failures = 0;
+    auto fail = [&](const std::string &message) {
+        std::cerr << message << "\n";
+        ++num_failures;
+    };
+
+    for(auto size : {cv::Size(1920, 1080), cv::Size(3840, 2160)}) {
+        cv::Mat img(size, CV_8UC3);
+        cv::randu(img, cv::Scalar::all(0), cv::Scalar::all(256));
+        auto pipeline = build_pipeline_from_json(pipeline_spec);
+        pipeline->fit(img);
+        const auto frame = pipeline->transform(img, timestamp);
+
+        std::vector<std::vector<cv::Point2f>> marker_corners, data_marker_corners;
+        std::vector<int> marker_inds, data_marker_inds;
+        detector.detect(frame, marker_corners, marker_inds);
+        detector.detect_data_markers(frame, data_marker_corners, data_marker_inds);
+        const auto markers = data_markers(marker_corners, marker_inds);
+        if (markers.size() != cv_aruco_marker_inds.size()) {
+            fail(format("{}x{}: detect() finds {} of the data markers", frame.cols, frame.rows, markers.size()));
+        }
+        if (!same_markers(markers, data_markers(data_marker_corners, data_marker_inds))) {
+            fail(format("{}x{}: the corner search finds other markers than detect()", frame.cols, frame.rows));
+        }
+
+        cv::Mat canvas(frame.rows + frame.rows / 2, frame.cols + frame.cols / 2, CV_8UC3, cv::Scalar::all(127));
+        frame.copyTo(canvas(cv::Rect(0, 0, frame.cols, frame.rows)));
+
+        ImageDataTransform info, reference_info;
+        if (!VideoScramblePipeline::get_data_extraction_transform(frame, info, detector) ||
+            !VideoScramblePipeline::get_data_extraction_transform(canvas, reference_info, detector)) {
+            fail(format("{}x{}: no data extraction transform", frame.cols, frame.rows));
+            continue;
+        }
+        if (!same_transform(info, reference_info)) {
+            fail(format("{}x{}: the corner search gives another transform than detect()", frame.cols, frame.rows));
+        }
+        if (cv::norm(pipeline->inverse_transform(frame, info, timestamp), img, cv::NORM_INF) != 0) {
+            fail(format("{}x{}: the detected transform does not restore the frame", frame.cols, frame.rows));
+        }
+    }
+
+    if (num_failures != 0) {
+        return 1;
+    }
+    std::cout << "the corner search matches detect() at 1080p and 4K\n";
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include "pipeline_metadata.h"
+#include <iostream>
+
+// Checks the binary pipeline metadata: a record decodes back to what was encoded, and a record with a changed byte
+// or cut short at any position is rejected.
+
+static bool same_metadata(const PipelineMetadata &a, const PipelineMetadata &b) {
+    if (a.data_embed_block_size != b.data_embed_block_size || a.data_embed_num_rows != b.data_embed_num_rows ||
+        a.data_embed_interval != b.data_embed_interval ||
+        a.state.output_width_wo_data != b.state.output_width_wo_data ||
+        a.state.output_height_wo_data != b.state.output_height_wo_data ||
+        a.state.data_region_width != b.state.data_region_width ||
+        a.state.data_region_height != b.state.data_region_height ||
+        a.state.input_width != b.state.input_width || a.state.input_height != b.state.input_height ||
+        a.num_steps != b.num_steps) {
+        return false;
+    }
+    for(auto i = 0; i < a.num_steps; ++i) {
+        if (a.steps[i].type != b.steps[i].type || a.steps[i].params != b.steps[i].params) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int main() {
+    int num_failures = 0;
+    auto fail = [&](const std::string &message) {
+        std::cerr << message << "\n";
+        ++num_failures;
+    };
+
+    // a 4K pipeline with every step type, negative parameters and multi-byte varints
+    PipelineMetadata metadata;
+    metadata.data_embed_block_size = 8;
+    metadata.data_embed_num_rows = 4;
+    metadata.data_embed_interval = 60;
+    metadata.state.output_width_wo_data = 2160;
+    metadata.state.output_height_wo_data = 3840;
+    metadata.state.data_region_width = 2160;
+    metadata.state.data_region_height = 32;
+    metadata.state.input_width = 3840;
+    metadata.state.input_height = 2160;
+    const PipelineMetadata::Step steps[] = {
+        {ScramblerType::ImageShift, {1, -1}},
+        {ScramblerType::RowShuffle, {8, 42}},
+        {ScramblerType::ImageTranspose, {0, 0}},
+        {ScramblerType::RowMix, {2, 300}},
+        {ScramblerType::ImageShift, {-1000000, 2147483647}},
+    };
+    for(const auto &step : steps) {
+        metadata.steps[metadata.num_steps++] = step;
+    }
+    // the timestamp is not part of the record and must not be touched by the decoder
+    metadata.state.timestamp = 12345;
+
+    const auto record = encode_pipeline_metadata(metadata);
+    if (!is_binary_pipeline_metadata(record.data(), record.size())) {
+        fail("the record does not start with the magic");
+    }
+
+    PipelineMetadata decoded;
+    decoded.state.timestamp = 7;
+    if (!decode_pipeline_metadata(record.data(), record.size(), decoded) || !same_metadata(metadata, decoded)) {
+        fail("the record does not decode to the encoded metadata");
+    }
+    if (decoded.state.timestamp != 7) {
+        fail("the decoder changed the timestamp");
+    }
+
+    for(size_t i = 0; i < record.size(); ++i) {
+        for(int bit = 0; bit < 8; ++bit) {
+            auto corrupted = record;
+            corrupted[i] ^= (char)(1 << bit);
+            if (decode_pipeline_metadata(corrupted.data(), corrupted.size(), decoded)) {
+                fail(format("bit {} of byte {} flipped is accepted", bit, i));
+            }
+        }
+    }
+
+    for(size_t size = 0; size < record.size(); ++size) {
+        if (decode_pipeline_metadata(record.data(), size, decoded)) {
+            fail(format("the record cut to {} of {} bytes is accepted", size, record.size()));
+        }
+    }
+    // trailing bytes after the CRC are not a valid record either
+    if (decode_pipeline_metadata((record + '\0').data(), record.size() + 1, decoded)) {
+        fail("the record with a trailing byte is accepted");
+    }
+
+    if (num_failures != 0) {
+        std::cerr << format("{} failures\n", num_failures);
+        return 1;
+    }
+    std::cout << format("{} byte record round trips, {} corruptions and {} truncations rejected\n", record.size(),
+                        record.size() * 8, record.size());
+    return 0;
+}
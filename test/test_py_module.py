@@ -5,6 +5,7 @@ import skimage
 import skimage.transform, skimage.io
 import matplotlib.pyplot as plt
 import time
+import numpy as np
 
 script_path = Path(os.path.dirname(__file__))
 project_path = script_path.parent
@@ -74,7 +75,7 @@ def test_frame_time():
     for frame in video_frames:
         new_img = pipeline.transform(frame)
     et = time.time()
-    print('time per frame:', (et-st)/len(frame) * 1000)
+    print('time per frame:', (et-st)/len(video_frames) * 1000)
 
 def test_video_forward():
     new_frames = []
@@ -101,6 +102,52 @@ def test_forward_backward():
     plt.imshow(new_img_inv)
     plt.show()
 
+def test_fused_equivalence():
+    # fused gather path against the step by step path
+    pipeline_ref = py_vidscramble.build_pipeline_from_json(pipeline_spec_json)
+    pipeline_ref.set_permutation_fusion(False)
+    pipeline_ref.fit(video_frames[0])
+    pipeline.reset_timestamp()
+    for frame in video_frames[:120]:
+        new_img = pipeline.transform(frame)
+        new_img_ref = pipeline_ref.transform(frame)
+        assert (new_img == new_img_ref).all()
+    pipeline.reset_timestamp()
+    pipeline_ref.reset_timestamp()
+    tracker = py_vidscramble.DataRegionTracker()
+    for frame in video_frames[:120]:
+        new_img = pipeline_ref.transform(frame)
+        tracker.update(new_img)
+        info = tracker.get_transform()
+        assert (pipeline.inverse_transform(new_img, info) == pipeline_ref.inverse_transform(new_img, info)).all()
+    pipeline.reset_timestamp()
+
+def test_zero_copy():
+    # out= and (N, H, W, 3) batches against single frames at the same timestamps
+    frames = video_frames[:16]
+    out = pipeline.transform(frames[0], 0)
+    assert pipeline.transform(frames[0], 0, out=out) is out
+    batch = pipeline.transform(frames, 0)
+    assert batch.shape == (len(frames),) + out.shape
+    for i, frame in enumerate(frames):
+        assert (batch[i] == pipeline.transform(frame, i)).all()
+    # the _batch names take the same path, a list of frames is packed into one array
+    assert (pipeline.transform_batch(list(frames), 0) == batch).all()
+    tracker = py_vidscramble.DataRegionTracker()
+    assert tracker.update(batch[0]) == py_vidscramble.DataRegionTracker.Status.detected
+    info = tracker.get_transform()
+    recovered = np.empty_like(frames)
+    assert pipeline.inverse_transform(batch, info, 0, out=recovered) is recovered
+    for i in range(len(frames)):
+        assert (recovered[i] == pipeline.inverse_transform(batch[i], info, i)).all()
+    # frames of out= that share memory are rejected, not written concurrently
+    aliased = np.lib.stride_tricks.as_strided(out, shape=batch.shape, strides=(0,) + out.strides)
+    try:
+        pipeline.transform(frames, 0, out=aliased)
+        assert False, 'overlapping out= frames were accepted'
+    except RuntimeError:
+        pass
+
 def test_info_recovery():
     new_img = pipeline.transform(video_frames[0])
     new_img = skimage.transform.rescale(new_img, (1.0,1.2), channel_axis=2)
@@ -118,4 +165,6 @@ def test_info_recovery():
 # test_forward()
 # test_forward_backward()
 test_video_forward()
-# test_info_recovery()
\ No newline at end of file
+# test_info_recovery()
+test_fused_equivalence()
+test_zero_copy()
\ No newline at end of file
@@ -0,0 +1,120 @@
+#include "reed_solomon.h"
+#include "util.h"
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+// Checks the RS(15, 12) codec against codewords of the schifra encoder it replaced, and that every single symbol
+// error is corrected while every double error is rejected. Every block is decoded both as the only block (scalar
+// syndromes) and in front of another block (the SIMD syndromes when the SSE4.1 kernels are enabled).
+
+struct GoldenCodeword {
+    uint8_t data[rs_data_length];
+    uint8_t fec[rs_fec_length];
+};
+
+// schifra::reed_solomon::encoder<15, 3, 12> over GF(2^4) (x^4 + x + 1) with the generator roots alpha^0 .. alpha^2;
+// the high nibbles of the data are not part of the code
+const GoldenCodeword golden_codewords[] = {
+    {{0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, {0x00, 0x00, 0x00}},
+    {{0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0xfc}, {0x08, 0x09, 0x0d}},
+    {{0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f}, {0x0e, 0x09, 0x07}},
+    {{0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}, {0x0e, 0x09, 0x07}},
+    {{0x0f, 0x1e, 0x2d, 0x3c, 0x4b, 0x5a, 0x69, 0x78, 0x87, 0x96, 0xa5, 0xb4}, {0x05, 0x07, 0x02}},
+    {{0x84, 0x94, 0x5f, 0x76, 0x4b, 0x73, 0x5f, 0x42, 0x24, 0x6d, 0x96, 0x0f}, {0x05, 0x07, 0x0e}},
+    {{0x0d, 0x04, 0x00, 0x08, 0x04, 0x02, 0x08, 0x0e, 0x0d, 0x04, 0x08, 0x0b}, {0x08, 0x09, 0x0a}},
+};
+
+// decodes block as the only block and as the first of two; false when either throws
+static bool decode_both_paths(const int8_t *block, int8_t *scalar_out, int8_t *simd_out) {
+    int8_t two_blocks[2 * rs_code_length] = {};
+    std::memcpy(two_blocks, block, rs_code_length);
+    int8_t two_out[2 * rs_data_length];
+    try {
+        rs_decode_blocks(block, 1, scalar_out);
+        rs_decode_blocks(two_blocks, 2, two_out);
+    } catch (const std::runtime_error &) {
+        return false;
+    }
+    std::memcpy(simd_out, two_out, rs_data_length);
+    return true;
+}
+
+int main() {
+    int num_failures = 0;
+    auto fail = [&](const std::string &message) {
+        std::cerr << message << "\n";
+        ++num_failures;
+    };
+
+    for(const auto &golden : golden_codewords) {
+        int8_t code[rs_code_length];
+        rs_encode_blocks(reinterpret_cast<const char*>(golden.data), rs_data_length, code);
+        if (std::memcmp(code, golden.data, rs_data_length) != 0 ||
+            std::memcmp(code + rs_data_length, golden.fec, rs_fec_length) != 0) {
+            fail(format("codeword of block {:02x}.. differs from the schifra one", golden.data[0]));
+            continue;
+        }
+
+        int8_t scalar_out[rs_data_length], simd_out[rs_data_length];
+        if (!decode_both_paths(code, scalar_out, simd_out) ||
+            std::memcmp(scalar_out, golden.data, rs_data_length) != 0 ||
+            std::memcmp(simd_out, golden.data, rs_data_length) != 0) {
+            fail(format("clean codeword of block {:02x}.. does not decode", golden.data[0]));
+        }
+
+        for(size_t p = 0; p < rs_code_length; ++p) {
+            for(int e = 1; e < 16; ++e) {
+                int8_t corrupted[rs_code_length];
+                std::memcpy(corrupted, code, rs_code_length);
+                corrupted[p] ^= (int8_t)e;
+                if (!decode_both_paths(corrupted, scalar_out, simd_out) ||
+                    std::memcmp(scalar_out, golden.data, rs_data_length) != 0 ||
+                    std::memcmp(simd_out, golden.data, rs_data_length) != 0) {
+                    fail(format("error {} at position {} of block {:02x}.. is not corrected", e, p,
+                                golden.data[0]));
+                }
+            }
+        }
+
+        for(size_t p0 = 0; p0 < rs_code_length; ++p0) {
+            for(size_t p1 = p0 + 1; p1 < rs_code_length; ++p1) {
+                for(int e0 = 1; e0 < 16; ++e0) {
+                    for(int e1 = 1; e1 < 16; ++e1) {
+                        int8_t corrupted[rs_code_length];
+                        std::memcpy(corrupted, code, rs_code_length);
+                        corrupted[p0] ^= (int8_t)e0;
+                        corrupted[p1] ^= (int8_t)e1;
+                        int8_t two_blocks[2 * rs_code_length] = {};
+                        std::memcpy(two_blocks, corrupted, rs_code_length);
+                        bool scalar_rejected = false, simd_rejected = false;
+                        try {
+                            rs_decode_blocks(corrupted, 1, scalar_out);
+                        } catch (const std::runtime_error &) {
+                            scalar_rejected = true;
+                        }
+                        try {
+                            int8_t two_out[2 * rs_data_length];
+                            rs_decode_blocks(two_blocks, 2, two_out);
+                        } catch (const std::runtime_error &) {
+                            simd_rejected = true;
+                        }
+                        if (!scalar_rejected || !simd_rejected) {
+                            fail(format("errors {} and {} at positions {} and {} of block {:02x}.. are not rejected",
+                                        e0, e1, p0, p1, golden.data[0]));
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (num_failures != 0) {
+        std::cerr << format("{} failures\n", num_failures);
+        return 1;
+    }
+    std::cout << format("{} golden codewords, single errors corrected, double errors rejected\n",
+                        std::size(golden_codewords));
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include "data_embed.h"
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+// Checks the expanded representation of the data band: the vector kernels (whole chunks of 16 bytes, or 64 expanded
+// bytes) against the table path (the bytes after the last whole chunk) for every byte value, the expansion against
+// the float formula of the original implementation, and the round trip.
+
+int main() {
+    int num_failures = 0;
+    auto fail = [&](const std::string &message) {
+        std::cerr << message << "\n";
+        ++num_failures;
+    };
+
+    std::vector<uint8_t> values(256);
+    for(auto v = 0; v < 256; ++v) {
+        values[v] = (uint8_t)v;
+    }
+
+    for(int expansion : {1, 2, 4}) {
+        const int num_bits_per_part = 8 / expansion;
+        const int num_values_per_part = 1 << num_bits_per_part;
+
+        // all values in one call take the kernel, one value per call takes the table
+        std::vector<uint8_t> expanded(256 * expansion), expanded_one(expansion);
+        expand_representation(values.data(), values.size(), expansion, expanded.data());
+        for(auto v = 0; v < 256; ++v) {
+            expand_representation(&values[v], 1, expansion, expanded_one.data());
+            for(auto j = 0; j < expansion; ++j) {
+                const int part = (v >> (j * num_bits_per_part)) & (num_values_per_part - 1);
+                const auto expected = (uint8_t)std::lround((part + 0.5f) * 256.0f / num_values_per_part);
+                if (expanded[v * expansion + j] != expected || expanded_one[j] != expected) {
+                    fail(format("expansion {}: part {} of {} is {} (kernel) and {} (table), expected {}", expansion,
+                                j, v, expanded[v * expansion + j], expanded_one[j], expected));
+                }
+            }
+        }
+
+        std::vector<uint8_t> shrunk(256);
+        shrink_representation(expanded.data(), expanded.size(), expansion, shrunk.data());
+        if (shrunk != values) {
+            fail(format("expansion {}: the kernel does not shrink the expanded values back", expansion));
+        }
+
+        // every byte value at every part position: group g holds g, g + 64, g + 128 and g + 192 (mod 256) in
+        // rotating order
+        std::vector<uint8_t> noisy(256 * expansion);
+        for(auto g = 0; g < 256; ++g) {
+            for(auto j = 0; j < expansion; ++j) {
+                noisy[g * expansion + j] = (uint8_t)(g + 64 * ((g + j) % 4));
+            }
+        }
+        shrink_representation(noisy.data(), noisy.size(), expansion, shrunk.data());
+        for(auto g = 0; g < 256; ++g) {
+            uint8_t shrunk_one;
+            shrink_representation(&noisy[g * expansion], expansion, expansion, &shrunk_one);
+            if (shrunk[g] != shrunk_one) {
+                fail(format("expansion {}: group {} shrinks to {} (kernel) and {} (table)", expansion, g, shrunk[g],
+                            shrunk_one));
+            }
+        }
+    }
+
+    if (num_failures != 0) {
+        std::cerr << format("{} failures\n", num_failures);
+        return 1;
+    }
+    std::cout << "kernels and tables agree on every byte value\n";
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include "pipeline_parser.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Counts the heap allocations through operator new of this binary (a library with its own runtime, as a Windows dll,
+// is not seen) and the frame buffers OpenCV allocates, so the steady state of transform_into /
+// inverse_transform_into can be checked for allocator churn.
+static std::atomic<size_t> num_heap_allocations{0};
+
+// the replacements pair malloc with free, which gcc cannot see through
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void *operator new(size_t size) {
+    ++num_heap_allocations;
+    if (void *ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void *ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+class CountingAllocator : public cv::MatAllocator {
+public:
+    cv::UMatData *allocate(int dims, const int *sizes, int type, void *data, size_t *step,
+                           cv::AccessFlag flags, cv::UMatUsageFlags usage_flags) const override {
+        if (data == nullptr) {
+            ++num_allocations;
+        }
+        return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage_flags);
+    }
+
+    bool allocate(cv::UMatData *data, cv::AccessFlag flags, cv::UMatUsageFlags usage_flags) const override {
+        return cv::Mat::getStdAllocator()->allocate(data, flags, usage_flags);
+    }
+
+    void deallocate(cv::UMatData *data) const override {
+        cv::Mat::getStdAllocator()->deallocate(data);
+    }
+
+    mutable std::atomic<int> num_allocations{0};
+};
+
+const char *pipeline_spec = R"({
+    "data_embed_block_size": 8,
+    "data_embed_num_rows": 4,
+    "data_embed_interval": 3,
+    "steps": [
+        {"name": "ImageShift", "sx": 3, "sy": -2},
+        {"name": "RowShuffle", "row_group_size": 8, "random_seed": 42},
+        {"name": "ImageTranspose"},
+        {"name": "RowMix", "row_group_size": 4, "random_seed": 7},
+        {"name": "ImageShift", "sx": -5, "sy": 1},
+        {"name": "ImageTranspose"},
+        {"name": "RowShuffle", "row_group_size": 8, "random_seed": 300}
+    ]
+})";
+
+int main() {
+    CountingAllocator allocator;
+    cv::Mat::setDefaultAllocator(&allocator);
+
+    cv::Mat img(720, 1280, CV_8UC3);
+    cv::randu(img, cv::Scalar::all(0), cv::Scalar::all(256));
+
+    auto pipeline = build_pipeline_from_json(pipeline_spec);
+    // a pool of its own, so the task queues are exercised on any machine
+    pipeline->set_num_threads(4);
+    pipeline->fit(img);
+
+    // the layout of the output is known here, so the image region is set directly instead of being detected
+    auto state = nlohmann::json::parse(pipeline->to_json())["state"];
+    ImageDataTransform info;
+    info.image_region_x = 0;
+    info.image_region_y = data_embed_top_pad_rows;
+    info.image_region_width = info.original_image_region_width = state["output_width_wo_data"].get<int>();
+    info.image_region_height = info.original_image_region_height = state["output_height_wo_data"].get<int>();
+
+    cv::Mat scrambled, restored;
+    const int num_warm_up_frames = 2 * pipeline->get_data_embed_interval();
+    const int num_frames = 4 * pipeline->get_data_embed_interval();
+
+    pipeline->set_timestamp_increment(false);
+    for(auto i = 0; i < num_warm_up_frames + num_frames; ++i) {
+        if (i == num_warm_up_frames) {
+            allocator.num_allocations = 0;
+            num_heap_allocations = 0;
+        }
+        pipeline->transform_into(img, scrambled);
+        pipeline->inverse_transform_into(scrambled, info, restored);
+        pipeline->increment_timestamp();
+    }
+
+    cv::Mat::setDefaultAllocator(nullptr);
+    const size_t num_heap_allocations_after_warm_up = num_heap_allocations;
+
+    if (restored.size() != img.size()) {
+        std::cerr << format("restored frame has size {}x{}, expected {}x{}\n",
+                            restored.cols, restored.rows, img.cols, img.rows);
+        return 1;
+    }
+    if (allocator.num_allocations != 0) {
+        std::cerr << format("{} frame buffers were allocated after warm-up\n", allocator.num_allocations.load());
+        return 1;
+    }
+    if (num_heap_allocations_after_warm_up != 0) {
+        std::cerr << format("{} heap allocations after warm-up\n", num_heap_allocations_after_warm_up);
+        return 1;
+    }
+    std::cout << format("no allocations over {} frames\n", num_frames);
+    return 0;
+}